@@ -1,18 +1,57 @@
 #include "book_code/rtweekend.h"
 #include "book_code/box.h"
 #include "book_code/bvh.h"
+#include "book_code/bvh_cache.h"
 #include "book_code/camera.h"
 #include "book_code/color.h"
+#include "book_code/compressed_bvh.h"
 #include "book_code/constant_medium.h"
 #include "book_code/hittable_list.h"
+#include "book_code/instance.h"
+#include "book_code/linear_bvh.h"
 #include "book_code/material.h"
 #include "book_code/moving_sphere.h"
 #include "book_code/sphere.h"
 #include "book_code/texture.h"
+#include "book_code/wide_bvh.h"
 
+#include <functional>
 
-inline hittable_list random_scene() {
+
+// Moves a scene's objects to where they are `seconds` into its animation - centers and
+// transforms at the shutter opening (ray time 0), and `exposure` seconds later at its closing
+// (ray time 1). Scenes that animate hand one back through their last argument; refitting the
+// boxes over what moved is left to the caller.
+typedef std::function<void(double seconds, double exposure)> scene_animation;
+
+
+// acceleration structure over a list, in whichever layout the options ask for - the flat
+// layouts come out of options.cache_dir when it's set and already has this one
+inline shared_ptr<hittable> make_bvh(hittable_list& list, double time0, double time1, const bvh_options& options) {
+    switch (options.layout) {
+        case bvh_layout::binary:     return make_shared<bvh_tree>(make_shared<bvh_node>(list, time0, time1, options), options);
+        case bvh_layout::linear:     return cached_bvh<linear_bvh>(list, time0, time1, options);
+        case bvh_layout::compressed: return cached_bvh<compressed_bvh>(list, time0, time1, options);
+        default:
+        case bvh_layout::wide:       return cached_bvh<wide_bvh>(list, time0, time1, options);
+    }
+}
+
+// same, over a tree that's already been built
+inline shared_ptr<hittable> make_bvh(const shared_ptr<bvh_node>& tree, double time0, double time1, const bvh_options& options) {
+    switch (options.layout) {
+        case bvh_layout::binary:     return make_shared<bvh_tree>(tree, options);
+        case bvh_layout::linear:     return make_shared<linear_bvh>(tree, time0, time1, options);
+        case bvh_layout::compressed: return make_shared<compressed_bvh>(tree, time0, time1, options);
+        default:
+        case bvh_layout::wide:       return make_shared<wide_bvh>(tree, time0, time1, options);
+    }
+}
+
+
+inline hittable_list random_scene(const bvh_options& options = bvh_options(), scene_animation* animate = nullptr) {
     hittable_list world;
+    std::vector<shared_ptr<moving_sphere>> bouncing;
 
     auto checker = make_shared<checker_texture>(
         make_shared<solid_color>(0.2, 0.3, 0.1),
@@ -34,8 +73,9 @@ inline hittable_list random_scene() {
                     auto albedo = color::random() * color::random();
                     sphere_material = make_shared<lambertian>(make_shared<solid_color>(albedo));
                     auto center2 = center + vec3(0, random_double(0,.5), 0);
-                    world.add(make_shared<moving_sphere>(
+                    bouncing.push_back(make_shared<moving_sphere>(
                         center, center2, 0.0, 1.0, 0.2, sphere_material));
+                    world.add(bouncing.back());
                 } else if (choose_mat < 0.95) {
                     // metal
                     auto albedo = color::random(0.5, 1);
@@ -60,7 +100,28 @@ inline hittable_list random_scene() {
     auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
     world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
 
-    return hittable_list(make_shared<bvh_node>(world, 0.0, 1.0));
+    if (animate) {
+        // the diffuse spheres bounce, a second apart, as high as they moved in the still - the
+        // phase comes from where they sit, so the scene's random numbers are left alone
+        struct bounce { shared_ptr<moving_sphere> s; point3 ground; double height, phase; };
+        std::vector<bounce> bounces;
+        for (const auto& s : bouncing) {
+            double phase = s->center0.x() * 0.618034 + s->center0.z() * 0.381966;
+            bounces.push_back({s, s->center0, s->center1.y() - s->center0.y(), phase - floor(phase)});
+        }
+
+        *animate = [bounces](double seconds, double exposure) {
+            auto at = [](const bounce& b, double t) {
+                return b.ground + vec3(0, b.height * fabs(sin(pi * (t + b.phase))), 0);
+            };
+            for (const auto& b : bounces) {
+                b.s->center0 = at(b, seconds);
+                b.s->center1 = at(b, seconds + exposure);
+            }
+        };
+    }
+
+    return hittable_list(make_bvh(world, 0.0, 1.0, options));
 }
 
 
@@ -114,7 +175,7 @@ inline hittable_list simple_light() {
 }
 
 
-inline hittable_list cornell_box() {
+inline hittable_list cornell_box(scene_animation* animate = nullptr) {
     hittable_list objects;
 
     auto red   = make_shared<lambertian>(make_shared<solid_color>(.65, .05, .05));
@@ -129,16 +190,23 @@ inline hittable_list cornell_box() {
     objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
     objects.add(make_shared<flip_face>(make_shared<xy_rect>(0, 555, 0, 555, 555, white)));
 
-    shared_ptr<hittable> box1 = make_shared<box>(point3(0,0,0), point3(165,330,165), white);
-    box1 = make_shared<rotate_y>(box1,  15);
-    box1 = make_shared<translate>(box1, vec3(265,0,295));
+    auto box1 = make_shared<instance>(
+        make_shared<box>(point3(0,0,0), point3(165,330,165), white),
+        affine::translation(vec3(265,0,295)) * affine::rotation_y(15));
     objects.add(box1);
 
-    shared_ptr<hittable> box2 = make_shared<box>(point3(0,0,0), point3(165,165,165), white);
-    box2 = make_shared<rotate_y>(box2, -18);
-    box2 = make_shared<translate>(box2, vec3(130,0,65));
+    shared_ptr<hittable> box2 = make_shared<instance>(
+        make_shared<box>(point3(0,0,0), point3(165,165,165), white),
+        affine::translation(vec3(130,0,65)) * affine::rotation_y(-18));
     objects.add(box2);
 
+    // the tall box turns on its corner, a quarter turn every three seconds - instances
+    // only have the one transform, so it isn't blurred
+    if (animate)
+        *animate = [box1](double seconds, double exposure) {
+            box1->set_transform(affine::translation(vec3(265,0,295)) * affine::rotation_y(15 + 30*seconds));
+        };
+
     return objects;
 }
 
@@ -162,9 +230,9 @@ inline hittable_list cornell_balls() {
     objects.add(boundary);
     objects.add(make_shared<constant_medium>(boundary, 0.1, make_shared<solid_color>(1,1,1)));
 
-    shared_ptr<hittable> box1 = make_shared<box>(point3(0,0,0), point3(165,330,165), white);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3(265,0,295));
+    shared_ptr<hittable> box1 = make_shared<instance>(
+        make_shared<box>(point3(0,0,0), point3(165,330,165), white),
+        affine::translation(vec3(265,0,295)) * affine::rotation_y(15));
     objects.add(box1);
 
     return objects;
@@ -186,13 +254,13 @@ inline hittable_list cornell_smoke() {
     objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
     objects.add(make_shared<flip_face>(make_shared<xy_rect>(0, 555, 0, 555, 555, white)));
 
-    shared_ptr<hittable> box1 = make_shared<box>(point3(0,0,0), point3(165,330,165), white);
-    box1 = make_shared<rotate_y>(box1,  15);
-    box1 = make_shared<translate>(box1, vec3(265,0,295));
+    shared_ptr<hittable> box1 = make_shared<instance>(
+        make_shared<box>(point3(0,0,0), point3(165,330,165), white),
+        affine::translation(vec3(265,0,295)) * affine::rotation_y(15));
 
-    shared_ptr<hittable> box2 = make_shared<box>(point3(0,0,0), point3(165,165,165), white);
-    box2 = make_shared<rotate_y>(box2, -18);
-    box2 = make_shared<translate>(box2, vec3(130,0,65));
+    shared_ptr<hittable> box2 = make_shared<instance>(
+        make_shared<box>(point3(0,0,0), point3(165,165,165), white),
+        affine::translation(vec3(130,0,65)) * affine::rotation_y(-18));
 
     objects.add(make_shared<constant_medium>(box1, 0.1, make_shared<solid_color>(1,0.4,0.1)));
     /* objects.add(make_shared<constant_medium>(box1, 0.01, make_shared<solid_color>(0,0,0))); */
@@ -222,10 +290,9 @@ inline hittable_list cornell_final() {
     objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
     objects.add(make_shared<flip_face>(make_shared<xy_rect>(0, 555, 0, 555, 555, white)));
 
-    shared_ptr<hittable> boundary2 =
-        make_shared<box>(point3(0,0,0), point3(165,165,165), make_shared<dielectric>(1.5));
-    boundary2 = make_shared<rotate_y>(boundary2, -18);
-    boundary2 = make_shared<translate>(boundary2, vec3(130,0,65));
+    shared_ptr<hittable> boundary2 = make_shared<instance>(
+        make_shared<box>(point3(0,0,0), point3(165,165,165), make_shared<dielectric>(1.5)),
+        affine::translation(vec3(130,0,65)) * affine::rotation_y(-18));
 
     auto tex = make_shared<solid_color>(0.9, 0.9, 0.9);
 
@@ -236,7 +303,7 @@ inline hittable_list cornell_final() {
 }
 
 
-inline hittable_list final_scene() {
+inline hittable_list final_scene(const bvh_options& options = bvh_options(), scene_animation* animate = nullptr) {
     hittable_list boxes1;
     auto ground = make_shared<lambertian>(make_shared<solid_color>(0.48, 0.83, 0.53));
 
@@ -257,7 +324,7 @@ inline hittable_list final_scene() {
 
     hittable_list objects;
 
-    objects.add(make_shared<bvh_node>(boxes1, 0, 1));
+    objects.add(make_bvh(boxes1, 0, 1, options));
 
     auto light = make_shared<diffuse_light>(make_shared<solid_color>(7, 7, 7));
     objects.add(make_shared<xz_rect>(123, 423, 147, 412, 554, light));
@@ -266,7 +333,8 @@ inline hittable_list final_scene() {
     auto center2 = center1 + vec3(30,0,0);
     auto moving_sphere_material =
         make_shared<lambertian>(make_shared<solid_color>(0.7, 0.3, 0.1));
-    objects.add(make_shared<moving_sphere>(center1, center2, 0, 1, 50, moving_sphere_material));
+    auto mover = make_shared<moving_sphere>(center1, center2, 0, 1, 50, moving_sphere_material);
+    objects.add(mover);
 
     objects.add(make_shared<sphere>(point3(260, 150, 45), 50, make_shared<dielectric>(1.5)));
     objects.add(make_shared<sphere>(
@@ -293,12 +361,20 @@ inline hittable_list final_scene() {
         boxes2.add(make_shared<sphere>(point3::random(0,165), 10, white));
     }
 
-    objects.add(make_shared<translate>(
-        make_shared<rotate_y>(
-            make_shared<bvh_node>(boxes2, 0.0, 1.0), 15),
-            vec3(-100,270,395)
-        )
-    );
-
+    auto cluster = make_shared<instance>(
+        make_bvh(boxes2, 0.0, 1.0, options),
+        affine::translation(vec3(-100,270,395)) * affine::rotation_y(15));
+    objects.add(cluster);
+
+    // the orange sphere slides along x at 30 units a second, and the cluster of white ones
+    // turns about its corner
+    if (animate)
+        *animate = [mover, center1, cluster](double seconds, double exposure) {
+            mover->center0 = center1 + vec3(30*seconds, 0, 0);
+            mover->center1 = center1 + vec3(30*(seconds + exposure), 0, 0);
+            cluster->set_transform(affine::translation(vec3(-100,270,395)) * affine::rotation_y(15 + 20*seconds));
+        };
+
+    // the renderer puts the top level BVH over these, with the ones built above as the bottom level
     return objects;
 }
@@ -14,6 +14,7 @@
 #include "rtweekend.h"
 
 #include "hittable.h"
+#include "material.h"
 
 
 class xy_rect: public hittable {
@@ -25,6 +26,19 @@ class xy_rect: public hittable {
         ) : x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mp(mat) {};
 
         virtual bool hit(const ray& r, double t0, double t1, hit_record& rec) const;
+        virtual bool occluded(const ray& r, double t0, double t1) const;
+        virtual void get_surface(const ray& r, hit_record& rec) const;
+
+        virtual double pdf_value(const point3& o, const vec3& v) const;
+        virtual vec3 random(const point3& o) const;
+
+        virtual void collect_lights(std::vector<const hittable*>& lights) const {
+            if (mp->is_emissive())
+                lights.push_back(this);
+        }
+
+        // where the ray crosses the plane, if that's within (t0, t1) and inside the rect
+        bool intersect(const ray& r, double t0, double t1, double& t) const;
 
         virtual bool bounding_box(double t0, double t1, aabb& output_box) const {
             // The bounding box must have non-zero width in each dimension, so pad the Z
@@ -47,6 +61,19 @@ class xz_rect: public hittable {
         ) : x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
 
         virtual bool hit(const ray& r, double t0, double t1, hit_record& rec) const;
+        virtual bool occluded(const ray& r, double t0, double t1) const;
+        virtual void get_surface(const ray& r, hit_record& rec) const;
+
+        virtual double pdf_value(const point3& o, const vec3& v) const;
+        virtual vec3 random(const point3& o) const;
+
+        virtual void collect_lights(std::vector<const hittable*>& lights) const {
+            if (mp->is_emissive())
+                lights.push_back(this);
+        }
+
+        // where the ray crosses the plane, if that's within (t0, t1) and inside the rect
+        bool intersect(const ray& r, double t0, double t1, double& t) const;
 
         virtual bool bounding_box(double t0, double t1, aabb& output_box) const {
             // The bounding box must have non-zero width in each dimension, so pad the Y
@@ -69,6 +96,19 @@ class yz_rect: public hittable {
         ) : y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
 
         virtual bool hit(const ray& r, double t0, double t1, hit_record& rec) const;
+        virtual bool occluded(const ray& r, double t0, double t1) const;
+        virtual void get_surface(const ray& r, hit_record& rec) const;
+
+        virtual double pdf_value(const point3& o, const vec3& v) const;
+        virtual vec3 random(const point3& o) const;
+
+        virtual void collect_lights(std::vector<const hittable*>& lights) const {
+            if (mp->is_emissive())
+                lights.push_back(this);
+        }
+
+        // where the ray crosses the plane, if that's within (t0, t1) and inside the rect
+        bool intersect(const ray& r, double t0, double t1, double& t) const;
 
         virtual bool bounding_box(double t0, double t1, aabb& output_box) const {
             // The bounding box must have non-zero width in each dimension, so pad the X
@@ -82,67 +122,175 @@ class yz_rect: public hittable {
 		shared_ptr<material> mp;
 };
 
-inline bool xy_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const {
-    auto t = (k-r.origin().z()) / r.direction().z();
-    if (t < t0 || t > t1)
+inline bool xy_rect::intersect(const ray& r, double t0, double t1, double& t) const {
+    auto t_plane = (k-r.origin().z()) / r.direction().z();
+    if (t_plane < t0 || t_plane > t1)
         return false;
 
-    auto x = r.origin().x() + t*r.direction().x();
-    auto y = r.origin().y() + t*r.direction().y();
+    auto x = r.origin().x() + t_plane*r.direction().x();
+    auto y = r.origin().y() + t_plane*r.direction().y();
     if (x < x0 || x > x1 || y < y0 || y > y1)
         return false;
 
-    rec.u = (x-x0)/(x1-x0);
-    rec.v = (y-y0)/(y1-y0);
-    rec.t = t;
+    t = t_plane;
+    return true;
+}
+
+inline bool xy_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const {
+    if (!intersect(r, t0, t1, rec.t))
+        return false;
+
+    rec.mat_ptr = mp.get();
+    rec.prim = this;
+
+    return true;
+}
+
+inline bool xy_rect::occluded(const ray& r, double t0, double t1) const {
+    double t;
+    return intersect(r, t0, t1, t);
+}
+
+inline void xy_rect::get_surface(const ray& r, hit_record& rec) const {
+    rec.p = r.at(rec.t);
     auto outward_normal = vec3(0, 0, 1);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
-    rec.p = r.at(t);
+    if (rec.mat_ptr->uses_uv()) {
+        rec.u = (rec.p.x()-x0)/(x1-x0);
+        rec.v = (rec.p.y()-y0)/(y1-y0);
+    }
+}
 
+inline bool xz_rect::intersect(const ray& r, double t0, double t1, double& t) const {
+    auto t_plane = (k-r.origin().y()) / r.direction().y();
+    if (t_plane < t0 || t_plane > t1)
+        return false;
+
+    auto x = r.origin().x() + t_plane*r.direction().x();
+    auto z = r.origin().z() + t_plane*r.direction().z();
+    if (x < x0 || x > x1 || z < z0 || z > z1)
+        return false;
+
+    t = t_plane;
     return true;
 }
 
 inline bool xz_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const {
-    auto t = (k-r.origin().y()) / r.direction().y();
-    if (t < t0 || t > t1)
+    if (!intersect(r, t0, t1, rec.t))
         return false;
 
-    auto x = r.origin().x() + t*r.direction().x();
-    auto z = r.origin().z() + t*r.direction().z();
-    if (x < x0 || x > x1 || z < z0 || z > z1)
-        return false;
+    rec.mat_ptr = mp.get();
+    rec.prim = this;
 
-    rec.u = (x-x0)/(x1-x0);
-    rec.v = (z-z0)/(z1-z0);
-    rec.t = t;
+    return true;
+}
+
+inline bool xz_rect::occluded(const ray& r, double t0, double t1) const {
+    double t;
+    return intersect(r, t0, t1, t);
+}
+
+inline void xz_rect::get_surface(const ray& r, hit_record& rec) const {
+    rec.p = r.at(rec.t);
     auto outward_normal = vec3(0, 1, 0);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
-    rec.p = r.at(t);
+    if (rec.mat_ptr->uses_uv()) {
+        rec.u = (rec.p.x()-x0)/(x1-x0);
+        rec.v = (rec.p.z()-z0)/(z1-z0);
+    }
+}
+
+inline bool yz_rect::intersect(const ray& r, double t0, double t1, double& t) const {
+    auto t_plane = (k-r.origin().x()) / r.direction().x();
+    if (t_plane < t0 || t_plane > t1)
+        return false;
+
+    auto y = r.origin().y() + t_plane*r.direction().y();
+    auto z = r.origin().z() + t_plane*r.direction().z();
+    if (y < y0 || y > y1 || z < z0 || z > z1)
+        return false;
 
+    t = t_plane;
     return true;
 }
 
 inline bool yz_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const {
-    auto t = (k-r.origin().x()) / r.direction().x();
-    if (t < t0 || t > t1)
+    if (!intersect(r, t0, t1, rec.t))
         return false;
 
-    auto y = r.origin().y() + t*r.direction().y();
-    auto z = r.origin().z() + t*r.direction().z();
-    if (y < y0 || y > y1 || z < z0 || z > z1)
-        return false;
+    rec.mat_ptr = mp.get();
+    rec.prim = this;
+
+    return true;
+}
+
+inline bool yz_rect::occluded(const ray& r, double t0, double t1) const {
+    double t;
+    return intersect(r, t0, t1, t);
+}
 
-    rec.u = (y-y0)/(y1-y0);
-    rec.v = (z-z0)/(z1-z0);
-    rec.t = t;
+inline void yz_rect::get_surface(const ray& r, hit_record& rec) const {
+    rec.p = r.at(rec.t);
     auto outward_normal = vec3(1, 0, 0);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
-    rec.p = r.at(t);
+    if (rec.mat_ptr->uses_uv()) {
+        rec.u = (rec.p.y()-y0)/(y1-y0);
+        rec.v = (rec.p.z()-z0)/(z1-z0);
+    }
+}
 
-    return true;
+inline double xy_rect::pdf_value(const point3& o, const vec3& v) const {
+    hit_record rec;
+    if (!this->hit(ray(o, v), 0.001, infinity, rec))
+        return 0;
+
+    // uniform over the area, converted to solid angle
+    auto area = (x1-x0)*(y1-y0);
+    auto distance_squared = rec.t * rec.t * v.length_squared();
+    auto cosine = fabs(v.z() / v.length());
+
+    return distance_squared / (cosine * area);
+}
+
+inline vec3 xy_rect::random(const point3& o) const {
+    auto random_point = point3(random_double(x0,x1), random_double(y0,y1), k);
+    return random_point - o;
+}
+
+inline double xz_rect::pdf_value(const point3& o, const vec3& v) const {
+    hit_record rec;
+    if (!this->hit(ray(o, v), 0.001, infinity, rec))
+        return 0;
+
+    // uniform over the area, converted to solid angle
+    auto area = (x1-x0)*(z1-z0);
+    auto distance_squared = rec.t * rec.t * v.length_squared();
+    auto cosine = fabs(v.y() / v.length());
+
+    return distance_squared / (cosine * area);
+}
+
+inline vec3 xz_rect::random(const point3& o) const {
+    auto random_point = point3(random_double(x0,x1), k, random_double(z0,z1));
+    return random_point - o;
+}
+
+inline double yz_rect::pdf_value(const point3& o, const vec3& v) const {
+    hit_record rec;
+    if (!this->hit(ray(o, v), 0.001, infinity, rec))
+        return 0;
+
+    // uniform over the area, converted to solid angle
+    auto area = (y1-y0)*(z1-z0);
+    auto distance_squared = rec.t * rec.t * v.length_squared();
+    auto cosine = fabs(v.x() / v.length());
+
+    return distance_squared / (cosine * area);
+}
+
+inline vec3 yz_rect::random(const point3& o) const {
+    auto random_point = point3(k, random_double(y0,y1), random_double(z0,z1));
+    return random_point - o;
 }
 
 #endif
@@ -17,21 +17,39 @@
 #include "hittable_list.h"
 
 
+// An axis aligned box, intersected directly with one slab test - the face that was hit is
+// the one the hit point is nearest. The six rects are only built for emissive boxes, which
+// sample their light through them.
+
 class box: public hittable  {
     public:
         box() {}
         box(const point3& p0, const point3& p1, shared_ptr<material> ptr);
 
         virtual bool hit(const ray& r, double t0, double t1, hit_record& rec) const;
+        virtual bool occluded(const ray& r, double t0, double t1) const;
+        virtual void get_surface(const ray& r, hit_record& rec) const;
 
         virtual bool bounding_box(double t0, double t1, aabb& output_box) const {
             output_box = aabb(box_min, box_max);
             return true;
         }
 
+        virtual double pdf_value(const point3& o, const vec3& v) const { return sides.pdf_value(o, v); }
+        virtual vec3 random(const point3& o) const { return sides.random(o); }
+
+        virtual void collect_lights(std::vector<const hittable*>& lights) const {
+            if (mp->is_emissive())
+                lights.push_back(this);
+        }
+
+        // the first crossing of a face within [t0, t1]
+        bool intersect(const ray& r, double t0, double t1, double& t) const;
+
     public:
         point3 box_min;
         point3 box_max;
+        shared_ptr<material> mp;
         hittable_list sides;
 };
 
@@ -39,6 +57,10 @@ class box: public hittable  {
 inline box::box(const point3& p0, const point3& p1, shared_ptr<material> ptr) {
     box_min = p0;
     box_max = p1;
+    mp = ptr;
+
+    if (!mp->is_emissive())
+        return;
 
     sides.add(make_shared<xy_rect>(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), ptr));
     sides.add(make_shared<flip_face>(
@@ -53,8 +75,79 @@ inline box::box(const point3& p0, const point3& p1, shared_ptr<material> ptr) {
         make_shared<yz_rect>(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), ptr)));
 }
 
+inline bool box::intersect(const ray& r, double t0, double t1, double& t) const {
+    double t_near = -infinity, t_far = infinity;
+
+    for (int a = 0; a < 3; a++) {
+        // fmin/fmax drop the NaN from a ray lying in one of the planes
+        auto ta = (box_min[a] - r.origin()[a]) / r.direction()[a];
+        auto tb = (box_max[a] - r.origin()[a]) / r.direction()[a];
+        auto enter = fmin(ta, tb);
+        auto leave = fmax(ta, tb);
+
+        t_near = fmax(t_near, enter);
+        t_far = fmin(t_far, leave);
+    }
+
+    if (t_near > t_far)
+        return false;
+
+    if (t_near >= t0 && t_near <= t1) {
+        t = t_near;
+        return true;
+    }
+
+    // starting inside the box (or past the entry), the way out is the only face left
+    if (t_far >= t0 && t_far <= t1) {
+        t = t_far;
+        return true;
+    }
+
+    return false;
+}
+
 inline bool box::hit(const ray& r, double t0, double t1, hit_record& rec) const {
-    return sides.hit(r, t0, t1, rec);
+    if (!intersect(r, t0, t1, rec.t))
+        return false;
+
+    rec.mat_ptr = mp.get();
+    rec.prim = this;
+
+    return true;
+}
+
+inline bool box::occluded(const ray& r, double t0, double t1) const {
+    double t;
+    return intersect(r, t0, t1, t);
+}
+
+inline void box::get_surface(const ray& r, hit_record& rec) const {
+    rec.p = r.at(rec.t);
+
+    // the face the point is on - the side it's nearest, relative to the box's size along each
+    // axis (a flat box is on its face along the flat axis)
+    int axis = 0;
+    bool max_side = false;
+    double nearest = infinity;
+    for (int a = 0; a < 3; a++) {
+        double extent = box_max[a] - box_min[a];
+        double to_min = extent > 0 ? fabs(rec.p[a] - box_min[a]) / extent : 0;
+        double to_max = extent > 0 ? fabs(rec.p[a] - box_max[a]) / extent : 0;
+        if (to_min < nearest) { nearest = to_min; axis = a; max_side = false; }
+        if (to_max < nearest) { nearest = to_max; axis = a; max_side = true; }
+    }
+
+    vec3 outward_normal(0,0,0);
+    outward_normal[axis] = max_side ? 1 : -1;
+    rec.set_face_normal(r, outward_normal);
+
+    // same UVs the rects gave each face - the two remaining axes, in order
+    if (rec.mat_ptr->uses_uv()) {
+        int a = axis == 0 ? 1 : 0;
+        int b = axis == 2 ? 1 : 2;
+        rec.u = (rec.p[a] - box_min[a]) / (box_max[a] - box_min[a]);
+        rec.v = (rec.p[b] - box_min[b]) / (box_max[b] - box_min[b]);
+    }
 }
 
 
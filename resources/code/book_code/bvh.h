@@ -14,8 +14,137 @@
 #include "rtweekend.h"
 
 #include "hittable.h"
+#include "hittable_list.h"
+#include "../thread_pool.h"
 
 #include <algorithm>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+
+// How a bvh_node tree gets built. The book's builder (random axis, median split after a full
+// sort) is kept for comparison; the default is a binned Surface Area Heuristic build, which
+// picks the axis and split position by estimated traversal cost and can build subtrees in
+// parallel on a thread pool. The Morton builder trades some of that tree quality for a build
+// in linear time - for scenes that get rebuilt while they're being edited.
+
+enum class bvh_builder { sah, median, morton };
+
+// what the scenes get back from make_bvh() - the bvh_node tree itself (under a bvh_tree root
+// that rebuilds it on refit), that tree flattened into a linear_bvh, collapsed into a 4-wide
+// wide_bvh, or into a compressed_bvh with 8 bit bounds
+enum class bvh_layout { binary, linear, wide, compressed };
+
+class bvh_cache;
+
+struct bvh_options {
+    bvh_builder builder = bvh_builder::sah;
+    bvh_layout layout = bvh_layout::wide;
+    int bins = 16;                      // candidate split planes per axis
+    int max_leaf_size = 4;              // leaves never hold more than this many objects
+    double traversal_cost = 1.0;        // relative to one object intersection
+    double intersection_cost = 1.0;
+    thread_pool* pool = nullptr;        // build subtrees in parallel when set
+    size_t parallel_threshold = 1024;   // spans smaller than this are built serially
+    bool report = true;                 // print the SAH cost and build time
+    double rebuild_threshold = 0.25;    // refit() rebuilds once the SAH cost has grown this much
+    std::string cache_dir;              // flat layouts are saved here and loaded back - empty for off
+};
+
+
+// body(begin, end) over [0, count) - on the pool, when there's one and enough to be worth it
+template <typename F>
+inline void bvh_parallel_for(const bvh_options& options, size_t count, F body) {
+    if (options.pool && count >= options.parallel_threshold)
+        options.pool->parallel_for(count, body);
+    else
+        body(0, count);
+}
+
+
+// Recomputes a flat layout's interior nodes bottom up, given refit_node(n) for a node whose
+// children are already done, and children(n, f) calling f on each of its interior children.
+// The layouts keep nodes in depth first order, so every subtree is a contiguous run of the
+// array starting at its root: runs of up to parallel_threshold nodes are refit whole, as tasks
+// on the pool, then the few nodes above them one by one.
+template <typename Children, typename RefitNode>
+inline void bvh_refit_interior(const bvh_options& options, size_t count, Children children, RefitNode refit_node) {
+    if (!options.pool || count < options.parallel_threshold) {
+        for (size_t n = count; n-- > 0;)
+            refit_node(n);
+        return;
+    }
+
+    // one past the last node under n - down the last child until there's a node without any
+    auto subtree_end = [&](size_t n) {
+        while (true) {
+            size_t last = n;
+            children(n, [&](size_t c) { last = std::max(last, c); });
+            if (last == n)
+                return n + 1;
+            n = last;
+        }
+    };
+
+    std::vector<std::pair<size_t, size_t>> runs;
+    std::vector<size_t> above;
+    std::vector<size_t> pending{0};
+    while (!pending.empty()) {
+        size_t n = pending.back();
+        pending.pop_back();
+
+        size_t end = subtree_end(n);
+        if (end - n <= options.parallel_threshold) {
+            runs.emplace_back(n, end);
+        } else {
+            above.push_back(n);
+            children(n, [&](size_t c) { pending.push_back(c); });
+        }
+    }
+
+    options.pool->parallel_for(runs.size(), [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++)
+            for (size_t n = runs[r].second; n-- > runs[r].first;)
+                refit_node(n);
+    });
+
+    // children are always further along the array than their parent
+    std::sort(above.begin(), above.end(), std::greater<size_t>());
+    for (size_t n : above)
+        refit_node(n);
+}
+
+
+// Node indices still to visit in a flat layout's traversal - in a fixed array for any tree up to
+// a sane depth, and on the heap past it. SAH splits over badly spread objects (exponentially
+// spaced ones, say) can make a tree of any depth.
+template <size_t fixed_size>
+class bvh_stack {
+    public:
+        explicit bvh_stack(size_t size) : items(fixed) {
+            if (size > fixed_size) {
+                spilled.resize(size);
+                items = spilled.data();
+            }
+        }
+
+        bvh_stack(const bvh_stack&) = delete;
+        bvh_stack& operator=(const bvh_stack&) = delete;
+
+        void push(int index) { items[count++] = index; }
+        int pop() { return items[--count]; }
+        bool empty() const { return count == 0; }
+
+    private:
+        int fixed[fixed_size];
+        std::vector<int> spilled;
+        int* items;
+        size_t count = 0;
+};
 
 
 class bvh_node : public hittable  {
@@ -23,16 +152,40 @@ class bvh_node : public hittable  {
         bvh_node();
 
         bvh_node(hittable_list& list, double time0, double time1)
-            : bvh_node(list.objects, 0, list.objects.size(), time0, time1)
+            : bvh_node(list, time0, time1, bvh_options())
         {}
 
+        bvh_node(hittable_list& list, double time0, double time1, const bvh_options& options);
+
         bvh_node(
             std::vector<shared_ptr<hittable>>& objects,
             size_t start, size_t end, double time0, double time1);
 
+        bvh_node(shared_ptr<hittable> l, shared_ptr<hittable> r, const aabb& b)
+            : left(l), right(r), box(b)
+        {}
+
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const;
         virtual bool bounding_box(double t0, double t1, aabb& output_box) const;
 
+        virtual bool occluded(const ray& r, double t_min, double t_max) const {
+            return box.hit(r, t_min, t_max)
+                && (left->occluded(r, t_min, t_max) || (right != left && right->occluded(r, t_min, t_max)));
+        }
+
+        virtual void collect_lights(std::vector<const hittable*>& lights) const {
+            left->collect_lights(lights);
+            if (right != left)
+                right->collect_lights(lights);
+        }
+
+        // boxes recomputed bottom up, keeping the tree as it was built - bvh_tree decides
+        // when it's grown bad enough to rebuild, and refits the top of it in parallel
+        virtual void refit(double time0, double time1);
+
+        // just this node's box, around its children's
+        void update_box(double time0, double time1);
+
     public:
         shared_ptr<hittable> left;
         shared_ptr<hittable> right;
@@ -40,6 +193,56 @@ class bvh_node : public hittable  {
 };
 
 
+// Surface Area Heuristic cost of a tree, relative to one object intersection, for comparing
+// builds: each node costs its traversal/intersection work times the chance that a random ray
+// through the root box also passes through it (the ratio of surface areas).
+double bvh_sah_cost(const shared_ptr<hittable>& root, const bvh_options& options = bvh_options());
+
+
+// The root of a bvh_node tree as make_bvh() hands it out in the binary layout. It keeps the
+// options and the built tree's SAH cost, so that refit() can rebuild once the cost has grown
+// past rebuild_threshold, as the flat layouts do. With a pool, refit() splits the nodes over
+// parallel_threshold objects or more into tasks, the way the SAH builder splits its build.
+class bvh_tree : public hittable  {
+    public:
+        bvh_tree(shared_ptr<bvh_node> root, const bvh_options& options)
+            : tree(root), options(options), built_cost(bvh_sah_cost(root, options))
+        {
+            find_parallel_nodes(tree);
+        }
+
+        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+            return tree->hit(r, t_min, t_max, rec);
+        }
+
+        virtual bool bounding_box(double t0, double t1, aabb& output_box) const {
+            return tree->bounding_box(t0, t1, output_box);
+        }
+
+        virtual bool occluded(const ray& r, double t_min, double t_max) const {
+            return tree->occluded(r, t_min, t_max);
+        }
+
+        virtual void collect_lights(std::vector<const hittable*>& lights) const {
+            tree->collect_lights(lights);
+        }
+
+        virtual void refit(double time0, double time1);
+
+    public:
+        shared_ptr<bvh_node> tree;
+
+    private:
+        // objects under h, noting the nodes over enough of them to refit in parallel
+        size_t find_parallel_nodes(const shared_ptr<hittable>& h);
+        void refit_parallel(bvh_node* node, double time0, double time1);
+
+        bvh_options options;        // for refitting in parallel, and rebuilding
+        double built_cost;
+        std::unordered_set<const hittable*> parallel_nodes;
+};
+
+
 inline bool box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis) {
     aabb box_a;
     aabb box_b;
@@ -121,4 +324,589 @@ inline bool bvh_node::bounding_box(double t0, double t1, aabb& output_box) const
 }
 
 
+// Binned SAH builder - works on a flat array of (box, centroid, object) records, partitioning it
+// in place, and produces bvh_nodes with up to max_leaf_size objects per leaf.
+
+struct bvh_primitive {
+    aabb box;
+    point3 centroid;
+    shared_ptr<hittable> object;
+};
+
+class sah_builder {
+    public:
+        sah_builder(const bvh_options& opts) : options(opts) {}
+
+        shared_ptr<hittable> build(std::vector<bvh_primitive>& prims, size_t start, size_t end);
+
+    private:
+        const bvh_options& options;
+};
+
+
+inline aabb empty_box() {
+    return aabb(point3(infinity, infinity, infinity), point3(-infinity, -infinity, -infinity));
+}
+
+
+// the object itself for a leaf of one, otherwise a list of them
+inline shared_ptr<hittable> make_bvh_leaf(std::vector<bvh_primitive>& prims, size_t start, size_t end) {
+    if (end - start == 1)
+        return prims[start].object;
+
+    auto leaf = make_shared<hittable_list>();
+    for (size_t i = start; i < end; i++)
+        leaf->add(prims[i].object);
+    return leaf;
+}
+
+
+inline shared_ptr<hittable> sah_builder::build(
+    std::vector<bvh_primitive>& prims, size_t start, size_t end
+) {
+    size_t count = end - start;
+
+    aabb bounds = empty_box();
+    aabb centroid_bounds = empty_box();
+    for (size_t i = start; i < end; i++) {
+        bounds = surrounding_box(bounds, prims[i].box);
+        centroid_bounds = surrounding_box(centroid_bounds, aabb(prims[i].centroid, prims[i].centroid));
+    }
+
+    if (count == 1)
+        return make_bvh_leaf(prims, start, end);
+
+    // Evaluate the binned split candidates on all three axes, keep the cheapest.
+    const int num_bins = std::max(2, options.bins);
+    const double leaf_cost = options.intersection_cost * count;
+
+    int best_axis = -1;
+    int best_split = 0;
+    double best_cost = infinity;
+
+    std::vector<size_t> bin_count(num_bins);
+    std::vector<aabb> bin_box(num_bins);
+    std::vector<double> right_area(num_bins);
+    std::vector<size_t> right_count(num_bins);
+
+    for (int axis = 0; axis < 3; axis++) {
+        double lo = centroid_bounds.min()[axis];
+        double extent = centroid_bounds.max()[axis] - lo;
+        if (extent <= 0)
+            continue;
+
+        std::fill(bin_count.begin(), bin_count.end(), 0);
+        std::fill(bin_box.begin(), bin_box.end(), empty_box());
+
+        for (size_t i = start; i < end; i++) {
+            int b = std::min(num_bins - 1, static_cast<int>(num_bins * (prims[i].centroid[axis] - lo) / extent));
+            bin_count[b]++;
+            bin_box[b] = surrounding_box(bin_box[b], prims[i].box);
+        }
+
+        // sweep from the right to get the area and count of everything above each plane
+        aabb acc = empty_box();
+        size_t n = 0;
+        for (int b = num_bins - 1; b > 0; b--) {
+            acc = surrounding_box(acc, bin_box[b]);
+            n += bin_count[b];
+            right_count[b] = n;
+            right_area[b] = n ? acc.area() : 0;
+        }
+
+        // then from the left, costing the plane between bins b-1 and b
+        acc = empty_box();
+        n = 0;
+        for (int b = 1; b < num_bins; b++) {
+            acc = surrounding_box(acc, bin_box[b-1]);
+            n += bin_count[b-1];
+            if (n == 0 || right_count[b] == 0)
+                continue;
+
+            double cost = options.traversal_cost
+                        + options.intersection_cost * (n * acc.area() + right_count[b] * right_area[b])
+                          / bounds.area();
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = b;
+            }
+        }
+    }
+
+    if (count <= static_cast<size_t>(options.max_leaf_size) && leaf_cost <= best_cost)
+        return make_bvh_leaf(prims, start, end);
+
+    size_t mid;
+    if (best_axis < 0) {
+        // All centroids coincide, so no plane separates anything - split the list in half.
+        mid = start + count/2;
+    } else {
+        double lo = centroid_bounds.min()[best_axis];
+        double extent = centroid_bounds.max()[best_axis] - lo;
+        auto it = std::partition(prims.begin() + start, prims.begin() + end,
+            [&](const bvh_primitive& p) {
+                int b = std::min(num_bins - 1, static_cast<int>(num_bins * (p.centroid[best_axis] - lo) / extent));
+                return b < best_split;
+            });
+        mid = it - prims.begin();
+    }
+
+    shared_ptr<hittable> left, right;
+
+    if (options.pool && count >= options.parallel_threshold) {
+        // left half as a task, right half on this thread
+        task_group group;
+        options.pool->submit(group, [&]{ left = build(prims, start, mid); });
+        right = build(prims, mid, end);
+        options.pool->wait(group);
+    } else {
+        left = build(prims, start, mid);
+        right = build(prims, mid, end);
+    }
+
+    return make_shared<bvh_node>(left, right, bounds);
+}
+
+
+// Linear BVH builder (Karras, "Maximizing Parallelism in the Construction of BVHs, Octrees, and
+// k-d Trees", 2012). The primitives are sorted along a Morton curve through their centroids by
+// a parallel radix sort, then each interior node of the binary radix tree over the sorted codes
+// finds its own range and split from the codes alone - so no node waits on any other, and the
+// whole hierarchy is linear in the number of primitives. Spans of up to max_leaf_size end up in
+// one leaf. Codes are 30 bit (10 per axis), or 63 bit past a million primitives; equal codes
+// are told apart by their position in the sorted order.
+
+class morton_builder {
+    public:
+        morton_builder(const bvh_options& opts) : options(opts) {}
+
+        shared_ptr<hittable> build(std::vector<bvh_primitive>& prims);
+
+    private:
+        // interior node of the radix tree over the sorted primitives - children are interior
+        // nodes, or single primitives when the flag says so; first and last bound its span
+        struct radix_node {
+            uint32_t left, right;
+            uint32_t first, last;
+            bool left_leaf, right_leaf;
+        };
+
+        int prefix(int i, int j) const;
+        void radix_sort(int bits);
+        shared_ptr<hittable> emit(std::vector<bvh_primitive>& prims, uint32_t index, bool leaf, aabb& box);
+
+        // body(chunk, begin, end) over a fixed split of [0, count), on the pool when it's worth it
+        size_t chunk_count(size_t count) const;
+        template <typename F>
+        void chunked(size_t count, F body);
+
+        const bvh_options& options;
+        std::vector<uint64_t> codes;
+        std::vector<uint32_t> order;
+        std::vector<radix_node> nodes;
+};
+
+
+// spreads the low 10 bits out to every third bit
+inline uint64_t spread_bits_10(uint64_t x) {
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x30000ff;
+    x = (x | (x << 8))  & 0x300f00f;
+    x = (x | (x << 4))  & 0x30c30c3;
+    x = (x | (x << 2))  & 0x9249249;
+    return x;
+}
+
+// and the low 21 bits
+inline uint64_t spread_bits_21(uint64_t x) {
+    x &= 0x1fffff;
+    x = (x | (x << 32)) & 0x1f00000000ffffULL;
+    x = (x | (x << 16)) & 0x1f0000ff0000ffULL;
+    x = (x | (x << 8))  & 0x100f00f00f00f00fULL;
+    x = (x | (x << 4))  & 0x10c30c30c30c30c3ULL;
+    x = (x | (x << 2))  & 0x1249249249249249ULL;
+    return x;
+}
+
+
+inline size_t morton_builder::chunk_count(size_t count) const {
+    return (options.pool && count >= options.parallel_threshold) ? options.pool->size() * 4 : 1;
+}
+
+template <typename F>
+inline void morton_builder::chunked(size_t count, F body) {
+    size_t chunks = chunk_count(count);
+    if (chunks == 1) {
+        body(0, 0, count);
+        return;
+    }
+
+    options.pool->parallel_for(chunks, [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; c++)
+            body(c, count * c / chunks, count * (c + 1) / chunks);
+    });
+}
+
+
+// Length of the common prefix of the sorted codes at i and j, carrying on into the positions
+// themselves where the codes are equal - and -1 when j is out of range.
+inline int morton_builder::prefix(int i, int j) const {
+    if (j < 0 || j >= static_cast<int>(codes.size()))
+        return -1;
+
+    if (codes[i] == codes[j])
+        return 64 + __builtin_clz(static_cast<uint32_t>(i ^ j));
+    return __builtin_clzll(codes[i] ^ codes[j]);
+}
+
+
+// Least significant digit first, 8 bits a pass - each chunk counts its digits, a prefix sum
+// over (digit, chunk) gives every chunk its own place to write each digit to, and the scatter
+// keeps equal digits in order. Passes where every key has the same digit are skipped.
+inline void morton_builder::radix_sort(int bits) {
+    const size_t n = order.size();
+    const size_t chunks = chunk_count(n);
+    std::vector<uint32_t> sorted(n);
+    std::vector<std::array<size_t, 256>> offsets(chunks);
+
+    for (int shift = 0; shift < bits; shift += 8) {
+        chunked(n, [&](size_t chunk, size_t begin, size_t end) {
+            auto& count = offsets[chunk];
+            count.fill(0);
+            for (size_t i = begin; i < end; i++)
+                count[(codes[order[i]] >> shift) & 0xff]++;
+        });
+
+        size_t total = 0;
+        bool one_digit = false;
+        for (int d = 0; d < 256; d++) {
+            size_t digit_total = 0;
+            for (size_t c = 0; c < chunks; c++) {
+                size_t count = offsets[c][d];
+                offsets[c][d] = total + digit_total;
+                digit_total += count;
+            }
+            one_digit |= digit_total == n;
+            total += digit_total;
+        }
+        if (one_digit)
+            continue;
+
+        chunked(n, [&](size_t chunk, size_t begin, size_t end) {
+            auto& offset = offsets[chunk];
+            for (size_t i = begin; i < end; i++)
+                sorted[offset[(codes[order[i]] >> shift) & 0xff]++] = order[i];
+        });
+        order.swap(sorted);
+    }
+}
+
+
+inline shared_ptr<hittable> morton_builder::build(std::vector<bvh_primitive>& prims) {
+    const size_t n = prims.size();
+    if (n <= static_cast<size_t>(std::max(1, options.max_leaf_size)))
+        return make_bvh_leaf(prims, 0, n);
+
+    aabb centroid_bounds = empty_box();
+    for (const auto& p : prims)
+        centroid_bounds = surrounding_box(centroid_bounds, aabb(p.centroid, p.centroid));
+
+    // codes on a grid over the centroids' box
+    const int axis_bits = n > (1u << 20) ? 21 : 10;
+    const double cells = static_cast<double>(1u << axis_bits);
+    vec3 scale;
+    for (int a = 0; a < 3; a++) {
+        double extent = centroid_bounds.max()[a] - centroid_bounds.min()[a];
+        scale[a] = extent > 0 ? cells / extent : 0;
+    }
+
+    codes.resize(n);
+    order.resize(n);
+    chunked(n, [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            uint64_t code = 0;
+            for (int a = 0; a < 3; a++) {
+                double cell = (prims[i].centroid[a] - centroid_bounds.min()[a]) * scale[a];
+                uint64_t q = static_cast<uint64_t>(std::min(std::max(cell, 0.0), cells - 1));
+                code |= (axis_bits == 10 ? spread_bits_10(q) : spread_bits_21(q)) << (2 - a);
+            }
+            codes[i] = code;
+            order[i] = static_cast<uint32_t>(i);
+        }
+    });
+
+    radix_sort(3 * axis_bits);
+
+    // primitives and codes into Morton order, so every node's primitives are one span
+    std::vector<bvh_primitive> sorted_prims(n);
+    std::vector<uint64_t> sorted_codes(n);
+    chunked(n, [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            sorted_prims[i] = std::move(prims[order[i]]);
+            sorted_codes[i] = codes[order[i]];
+        }
+    });
+    prims.swap(sorted_prims);
+    codes.swap(sorted_codes);
+
+    // every interior node on its own: which way its span runs from i, how far (a doubling
+    // search, then a binary one), and where the first bit that differs inside it changes
+    nodes.resize(n - 1);
+    chunked(n - 1, [&](size_t, size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++) {
+            int i = static_cast<int>(k);
+            int d = prefix(i, i + 1) > prefix(i, i - 1) ? 1 : -1;
+
+            int min_prefix = prefix(i, i - d);
+            int length_max = 2;
+            while (prefix(i, i + length_max * d) > min_prefix)
+                length_max *= 2;
+            int length = 0;
+            for (int t = length_max / 2; t >= 1; t /= 2)
+                if (prefix(i, i + (length + t) * d) > min_prefix)
+                    length += t;
+            int j = i + length * d;
+
+            int node_prefix = prefix(i, j);
+            int s = 0;
+            for (int divisor = 2, t = length; t > 1; divisor *= 2) {
+                t = (length + divisor - 1) / divisor;
+                if (prefix(i, i + (s + t) * d) > node_prefix)
+                    s += t;
+            }
+            int split = i + s * d + std::min(d, 0);
+
+            radix_node& node = nodes[k];
+            node.first = static_cast<uint32_t>(std::min(i, j));
+            node.last = static_cast<uint32_t>(std::max(i, j));
+            node.left = static_cast<uint32_t>(split);
+            node.right = static_cast<uint32_t>(split + 1);
+            node.left_leaf = node.first == node.left;
+            node.right_leaf = node.last == node.right;
+        }
+    });
+
+    aabb box;
+    return emit(prims, 0, false, box);
+}
+
+
+// The radix tree as bvh_nodes, boxes on the way back up. Spans that fit in a leaf become one.
+inline shared_ptr<hittable> morton_builder::emit(
+    std::vector<bvh_primitive>& prims, uint32_t index, bool leaf, aabb& box
+) {
+    size_t first = leaf ? index : nodes[index].first;
+    size_t last = leaf ? index : nodes[index].last;
+    size_t count = last - first + 1;
+
+    if (leaf || count <= static_cast<size_t>(options.max_leaf_size)) {
+        box = prims[first].box;
+        for (size_t i = first + 1; i <= last; i++)
+            box = surrounding_box(box, prims[i].box);
+        return make_bvh_leaf(prims, first, last + 1);
+    }
+
+    const radix_node& node = nodes[index];
+    shared_ptr<hittable> left, right;
+    aabb box_left, box_right;
+
+    if (options.pool && count >= options.parallel_threshold) {
+        task_group group;
+        options.pool->submit(group, [&]{ left = emit(prims, node.left, node.left_leaf, box_left); });
+        right = emit(prims, node.right, node.right_leaf, box_right);
+        options.pool->wait(group);
+    } else {
+        left = emit(prims, node.left, node.left_leaf, box_left);
+        right = emit(prims, node.right, node.right_leaf, box_right);
+    }
+
+    box = surrounding_box(box_left, box_right);
+    return make_shared<bvh_node>(left, right, box);
+}
+
+
+inline bvh_node::bvh_node(hittable_list& list, double time0, double time1, const bvh_options& options) {
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    if (options.builder == bvh_builder::median) {
+        *this = bvh_node(list.objects, 0, list.objects.size(), time0, time1);
+    } else {
+        std::vector<bvh_primitive> prims(list.objects.size());
+        bvh_parallel_for(options, prims.size(), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                if (!list.objects[i]->bounding_box(time0, time1, prims[i].box))
+                    std::cerr << "No bounding box in bvh_node constructor.\n";
+                prims[i].centroid = 0.5 * (prims[i].box.min() + prims[i].box.max());
+                prims[i].object = list.objects[i];
+            }
+        });
+
+        shared_ptr<hittable> root;
+        if (options.builder == bvh_builder::morton) {
+            morton_builder builder(options);
+            root = builder.build(prims);
+        } else {
+            sah_builder builder(options);
+            root = builder.build(prims, 0, prims.size());
+        }
+
+        auto root_node = std::dynamic_pointer_cast<bvh_node>(root);
+        if (root_node) {
+            *this = *root_node;
+        } else {
+            // the whole list fit in one leaf
+            left = right = root;
+            root->bounding_box(time0, time1, box);
+        }
+    }
+
+    if (options.report) {
+        auto end_time = std::chrono::high_resolution_clock::now();
+        auto ms = std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(end_time - start_time).count();
+        std::cout << "bvh over " << list.objects.size() << " objects ("
+                  << (options.builder == bvh_builder::sah    ? "binned SAH"
+                    : options.builder == bvh_builder::morton ? "Morton LBVH" : "median split")
+                  << "), SAH cost " << bvh_sah_cost(make_shared<bvh_node>(*this), options)
+                  << ", built in " << ms << "ms" << std::endl;
+    }
+}
+
+
+inline void bvh_node::refit(double time0, double time1) {
+    left->refit(time0, time1);
+    if (right != left)
+        right->refit(time0, time1);
+
+    update_box(time0, time1);
+}
+
+
+inline void bvh_node::update_box(double time0, double time1) {
+    aabb box_left, box_right;
+    if (!left->bounding_box(time0, time1, box_left) || !right->bounding_box(time0, time1, box_right))
+        std::cerr << "No bounding box in bvh_node refit.\n";
+
+    box = surrounding_box(box_left, box_right);
+}
+
+
+inline double bvh_sah_cost(const shared_ptr<hittable>& root, const bvh_options& options) {
+    aabb root_box;
+    if (!root->bounding_box(0, 1, root_box))
+        return 0;
+
+    const double root_area = root_box.area();
+
+    // iterative walk, so deep median-split trees don't blow the stack
+    double cost = 0;
+    std::vector<const hittable*> stack{root.get()};
+    while (!stack.empty()) {
+        const hittable* h = stack.back();
+        stack.pop_back();
+
+        aabb b;
+        h->bounding_box(0, 1, b);
+        double p = root_area > 0 ? b.area() / root_area : 1;
+
+        if (auto node = dynamic_cast<const bvh_node*>(h)) {
+            cost += options.traversal_cost * p;
+            stack.push_back(node->left.get());
+            if (node->right != node->left)
+                stack.push_back(node->right.get());
+        } else if (auto list = dynamic_cast<const hittable_list*>(h)) {
+            cost += options.intersection_cost * p * list->objects.size();
+        } else {
+            cost += options.intersection_cost * p;
+        }
+    }
+
+    return cost;
+}
+
+
+inline size_t bvh_tree::find_parallel_nodes(const shared_ptr<hittable>& h) {
+    if (!options.pool)
+        return 0;
+
+    auto node = dynamic_cast<const bvh_node*>(h.get());
+    if (!node) {
+        auto list = dynamic_cast<const hittable_list*>(h.get());
+        return list ? list->objects.size() : 1;
+    }
+
+    size_t count = find_parallel_nodes(node->left);
+    if (node->right != node->left)
+        count += find_parallel_nodes(node->right);
+
+    if (count >= options.parallel_threshold)
+        parallel_nodes.insert(node);
+    return count;
+}
+
+
+inline void bvh_tree::refit_parallel(bvh_node* node, double time0, double time1) {
+    auto refit_child = [&](const shared_ptr<hittable>& child) {
+        if (parallel_nodes.count(child.get()))
+            refit_parallel(static_cast<bvh_node*>(child.get()), time0, time1);
+        else
+            child->refit(time0, time1);
+    };
+
+    if (node->right != node->left) {
+        // left half as a task, right half on this thread
+        task_group group;
+        options.pool->submit(group, [&]{ refit_child(node->left); });
+        refit_child(node->right);
+        options.pool->wait(group);
+    } else {
+        refit_child(node->left);
+    }
+
+    node->update_box(time0, time1);
+}
+
+
+inline void bvh_tree::refit(double time0, double time1) {
+    if (parallel_nodes.count(tree.get()))
+        refit_parallel(tree.get(), time0, time1);
+    else
+        tree->refit(time0, time1);
+
+    double cost = bvh_sah_cost(tree, options);
+    if (cost > built_cost * (1 + options.rebuild_threshold)) {
+        // the leaves' objects, with lists opened up the way the flat layouts open them
+        hittable_list list;
+        std::vector<shared_ptr<hittable>> stack{tree};
+        while (!stack.empty()) {
+            auto h = stack.back();
+            stack.pop_back();
+
+            if (auto node = std::dynamic_pointer_cast<bvh_node>(h)) {
+                stack.push_back(node->left);
+                if (node->right != node->left)
+                    stack.push_back(node->right);
+            } else if (auto inner = std::dynamic_pointer_cast<hittable_list>(h)) {
+                stack.insert(stack.end(), inner->objects.begin(), inner->objects.end());
+            } else {
+                list.add(h);
+            }
+        }
+
+        bvh_options rebuild_options = options;
+        rebuild_options.report = false;
+        tree = make_shared<bvh_node>(list, time0, time1, rebuild_options);
+        built_cost = bvh_sah_cost(tree, options);
+
+        parallel_nodes.clear();
+        find_parallel_nodes(tree);
+
+        if (options.report)
+            std::cout << "refit SAH cost " << cost << " was past " << 1 + options.rebuild_threshold
+                      << "x the built tree's, rebuilt over " << list.objects.size()
+                      << " objects, SAH cost now " << built_cost << std::endl;
+    }
+}
+
+
 #endif
@@ -0,0 +1,552 @@
+#ifndef BVH_CACHE_H
+#define BVH_CACHE_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "compressed_bvh.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "wide_bvh.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// On-disk cache of built BVHs - the flat layouts' node arrays as they are in memory, plus which
+// object each primitive slot holds, by its position in the list (with any lists inside it opened
+// up, the way the layouts open them). A file is named for a hash of everything the build
+// depends on: the layout and builder options, the shutter interval, and every object's box in
+// list order. Same boxes in the same order means the same tree fits, so the build is skipped -
+// the file is mapped, checked and copied straight into the arrays, with nothing to parse.
+//
+// Only the acceleration structure is cached. Scenes are still made by running their functions:
+// objects, materials and textures are polymorphic and have no serialized form, so the cache
+// needs the list they make to point its slots at. bvh_node trees are pointers all the way down,
+// so the binary layout isn't cached either.
+
+struct bvh_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t layout;
+    uint64_t key;
+    uint32_t node_size;         // sizeof the node type, so a changed layout never matches
+    uint32_t motion_size;
+    uint64_t node_count;
+    uint64_t motion_count;
+    uint64_t primitive_count;
+    double root_box[6];
+    double shutter_open;
+    double inv_shutter;
+    double built_cost;
+    int32_t deepest;
+    int32_t padding;
+};
+
+
+// A read only mapping of a whole file - empty when it can't be opened.
+class mapped_file {
+    public:
+        explicit mapped_file(const std::string& path) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                return;
+
+            struct stat st;
+            if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p != MAP_FAILED) {
+                    bytes = static_cast<const unsigned char*>(p);
+                    length = static_cast<size_t>(st.st_size);
+                }
+            }
+            ::close(fd);
+        }
+
+        ~mapped_file() {
+            if (bytes)
+                munmap(const_cast<unsigned char*>(bytes), length);
+        }
+
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+
+        const unsigned char* data() const { return bytes; }
+        size_t size() const { return length; }
+
+    private:
+        const unsigned char* bytes = nullptr;
+        size_t length = 0;
+};
+
+
+class bvh_cache {
+    public:
+        static const uint32_t version = 2;
+
+        // the objects a flat layout over the list ends up holding, in order - the list's own, or,
+        // when there are lists among them, all of them opened up depth first into `opened`
+        static const std::vector<shared_ptr<hittable>>& primitives_of(
+            const hittable_list& list, std::vector<shared_ptr<hittable>>& opened);
+
+        // over the list, and the primitives_of() it
+        static uint64_t key(const hittable_list& list, const std::vector<shared_ptr<hittable>>& objects,
+                            double time0, double time1, const bvh_options& options);
+
+        // the cached BVH for this key, or null when there's no file or it doesn't fit the objects
+        template <typename T>
+        static shared_ptr<T> load(const std::string& path, uint64_t key,
+                                  const std::vector<shared_ptr<hittable>>& objects, const bvh_options& options);
+
+        // writes it out - false when it can't be written, or the BVH wasn't built over these objects
+        template <typename T>
+        static bool save(const std::string& path, uint64_t key, const T& bvh,
+                         const std::vector<shared_ptr<hittable>>& objects);
+
+        static std::string path(const std::string& dir, uint64_t key, bvh_layout layout) {
+            char name[32];
+            snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+            return dir + "/" + name + "_" + std::to_string(static_cast<int>(layout)) + ".bvh";
+        }
+
+    private:
+        // FNV-1a, a 64 bit word at a time
+        static void mix(uint64_t& h, uint64_t v) {
+            h ^= v;
+            h *= 0x100000001b3ULL;
+        }
+
+        static void mix(uint64_t& h, double d) {
+            uint64_t bits;
+            std::memcpy(&bits, &d, sizeof(bits));
+            mix(h, bits);
+        }
+
+        // the layout specific parts, both ways
+        static void header_from(bvh_cache_header& h, const linear_bvh& b);
+        static void header_from(bvh_cache_header& h, const wide_bvh& b);
+        static void header_from(bvh_cache_header& h, const compressed_bvh& b);
+        static void set_from(linear_bvh& b, const bvh_cache_header& h);
+        static void set_from(wide_bvh& b, const bvh_cache_header& h);
+        static void set_from(compressed_bvh& b, const bvh_cache_header& h);
+
+        // whether every index in the nodes points inside the arrays, and how deep the tree is
+        static bool check_nodes(const linear_bvh& b, size_t primitive_count, int& depth);
+        static bool check_nodes(const wide_bvh& b, size_t primitive_count, int& depth);
+        static bool check_nodes(const compressed_bvh& b, size_t primitive_count, int& depth);
+
+        template <typename Node, typename Empty>
+        static bool check_lanes(const std::vector<Node>& nodes, size_t primitive_count, Empty empty, int& depth);
+
+        template <typename T>
+        static bvh_layout layout_of();
+
+        static void open_up(const shared_ptr<hittable>& h, std::vector<shared_ptr<hittable>>& opened);
+};
+
+
+template <> inline bvh_layout bvh_cache::layout_of<linear_bvh>()     { return bvh_layout::linear; }
+template <> inline bvh_layout bvh_cache::layout_of<wide_bvh>()       { return bvh_layout::wide; }
+template <> inline bvh_layout bvh_cache::layout_of<compressed_bvh>() { return bvh_layout::compressed; }
+
+
+inline uint64_t bvh_cache::key(
+    const hittable_list& list, const std::vector<shared_ptr<hittable>>& objects,
+    double time0, double time1, const bvh_options& options
+) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    mix(h, static_cast<uint64_t>(version));
+    mix(h, static_cast<uint64_t>(options.layout));
+    mix(h, static_cast<uint64_t>(options.builder));
+    mix(h, static_cast<uint64_t>(options.bins));
+    mix(h, static_cast<uint64_t>(options.max_leaf_size));
+    mix(h, options.traversal_cost);
+    mix(h, options.intersection_cost);
+    mix(h, time0);
+    mix(h, time1);
+    mix(h, static_cast<uint64_t>(list.objects.size()));
+
+    // the wide layout's motion bounds come from the boxes at either end of the shutter
+    auto mix_box = [&h](const hittable& object, double t0, double t1) {
+        aabb box;
+        if (!object.bounding_box(t0, t1, box))
+            std::cerr << "No bounding box in bvh_cache key.\n";
+        for (int a = 0; a < 3; a++) {
+            mix(h, box.min()[a]);
+            mix(h, box.max()[a]);
+        }
+    };
+
+    for (const auto& object : list.objects) {
+        mix_box(*object, time0, time1);
+        if (time0 != time1) {
+            mix_box(*object, time0, time0);
+            mix_box(*object, time1, time1);
+        }
+    }
+
+    // lists among the objects were opened up, and the slots name what came out - so that has
+    // to match too
+    if (&objects != &list.objects) {
+        mix(h, static_cast<uint64_t>(objects.size()));
+        for (const auto& object : objects)
+            mix_box(*object, time0, time1);
+    }
+
+    return h;
+}
+
+
+inline void bvh_cache::open_up(const shared_ptr<hittable>& h, std::vector<shared_ptr<hittable>>& opened) {
+    if (auto list = std::dynamic_pointer_cast<hittable_list>(h)) {
+        for (const auto& object : list->objects)
+            open_up(object, opened);
+    } else {
+        opened.push_back(h);
+    }
+}
+
+
+inline const std::vector<shared_ptr<hittable>>& bvh_cache::primitives_of(
+    const hittable_list& list, std::vector<shared_ptr<hittable>>& opened
+) {
+    bool nested = false;
+    for (const auto& object : list.objects)
+        nested |= dynamic_cast<const hittable_list*>(object.get()) != nullptr;
+    if (!nested)
+        return list.objects;
+
+    opened.clear();
+    for (const auto& object : list.objects)
+        open_up(object, opened);
+    return opened;
+}
+
+
+inline void bvh_cache::header_from(bvh_cache_header& h, const linear_bvh& b) {
+    h.node_size = sizeof(linear_bvh_node);
+    h.node_count = b.nodes.size();
+    h.built_cost = b.built_cost;
+    h.deepest = b.deepest;
+}
+
+inline void bvh_cache::header_from(bvh_cache_header& h, const wide_bvh& b) {
+    h.node_size = sizeof(wide_bvh_node);
+    h.motion_size = sizeof(wide_bvh_motion);
+    h.node_count = b.nodes.size();
+    h.motion_count = b.motion.size();
+    for (int a = 0; a < 3; a++) {
+        h.root_box[a] = b.root_box.min()[a];
+        h.root_box[a + 3] = b.root_box.max()[a];
+    }
+    h.shutter_open = b.shutter_open;
+    h.inv_shutter = b.inv_shutter;
+    h.built_cost = b.built_cost;
+    h.deepest = b.deepest;
+}
+
+inline void bvh_cache::header_from(bvh_cache_header& h, const compressed_bvh& b) {
+    h.node_size = sizeof(compressed_bvh_node);
+    h.node_count = b.nodes.size();
+    for (int a = 0; a < 3; a++) {
+        h.root_box[a] = b.root_box.min()[a];
+        h.root_box[a + 3] = b.root_box.max()[a];
+    }
+    h.built_cost = b.built_cost;
+    h.deepest = b.deepest;
+}
+
+inline void bvh_cache::set_from(linear_bvh& b, const bvh_cache_header& h) {
+    b.built_cost = h.built_cost;
+    b.deepest = h.deepest;
+}
+
+inline void bvh_cache::set_from(wide_bvh& b, const bvh_cache_header& h) {
+    b.root_box = aabb(point3(h.root_box[0], h.root_box[1], h.root_box[2]),
+                      point3(h.root_box[3], h.root_box[4], h.root_box[5]));
+    b.shutter_open = h.shutter_open;
+    b.inv_shutter = h.inv_shutter;
+    b.built_cost = h.built_cost;
+    b.deepest = h.deepest;
+}
+
+inline void bvh_cache::set_from(compressed_bvh& b, const bvh_cache_header& h) {
+    b.root_box = aabb(point3(h.root_box[0], h.root_box[1], h.root_box[2]),
+                      point3(h.root_box[3], h.root_box[4], h.root_box[5]));
+    b.built_cost = h.built_cost;
+    b.deepest = h.deepest;
+}
+
+
+// The nodes have to make one tree in depth first order, as the layouts build them - each subtree
+// a contiguous run of the array starting at its root, which refit's tasks and bottom up passes
+// depend on. Walking the array backwards, every child is checked before its parent, so the end
+// of each subtree and its height are known by the time the parent needs them.
+inline bool bvh_cache::check_nodes(const linear_bvh& b, size_t primitive_count, int& depth) {
+    const size_t count = b.nodes.size();
+    std::vector<size_t> end(count);
+    std::vector<int> height(count);
+
+    for (size_t n = count; n-- > 0;) {
+        const linear_bvh_node& node = b.nodes[n];
+        if (node.count > 0) {
+            if (node.offset < 0 || static_cast<size_t>(node.offset) + node.count > primitive_count)
+                return false;
+            end[n] = n + 1;
+            height[n] = 1;
+            continue;
+        }
+
+        // the first child right after its parent, the second right after the first's subtree
+        if (node.count < 0 || node.axis < 0 || node.axis > 2 || n + 1 >= count
+            || node.offset <= static_cast<int>(n + 1) || static_cast<size_t>(node.offset) >= count
+            || static_cast<size_t>(node.offset) != end[n + 1])
+            return false;
+
+        end[n] = end[node.offset];
+        height[n] = 1 + std::max(height[n + 1], height[node.offset]);
+    }
+
+    depth = height[0];
+    return end[0] == count;
+}
+
+// Same for the 4-wide layouts, lane by lane - and unused lanes only ever at the end.
+template <typename Node, typename Empty>
+inline bool bvh_cache::check_lanes(const std::vector<Node>& nodes, size_t primitive_count, Empty empty, int& depth) {
+    const size_t count = nodes.size();
+    std::vector<size_t> end(count);
+    std::vector<int> height(count);
+
+    for (size_t n = count; n-- > 0;) {
+        const Node& node = nodes[n];
+        if (empty(node.count[0]))
+            return false;
+
+        size_t next = n + 1;    // where the next interior child's subtree has to start
+        int h = 1;
+        for (int i = 0; i < 4; i++) {
+            if (empty(node.count[i])) {
+                if (i + 1 < 4 && !empty(node.count[i + 1]))
+                    return false;
+                continue;
+            }
+
+            const long long lane_count = node.count[i];
+            const long long child = node.child[i];
+            if (lane_count > 0) {
+                if (child < 0 || static_cast<size_t>(child + lane_count) > primitive_count)
+                    return false;
+                continue;
+            }
+
+            if (lane_count < 0 || child < 0 || static_cast<size_t>(child) != next || next >= count)
+                return false;
+
+            next = end[child];
+            h = std::max(h, height[child] + 1);
+        }
+
+        end[n] = next;
+        height[n] = h;
+    }
+
+    depth = height[0];
+    return end[0] == count;
+}
+
+inline bool bvh_cache::check_nodes(const wide_bvh& b, size_t primitive_count, int& depth) {
+    if (!b.motion.empty() && b.motion.size() != b.nodes.size())
+        return false;
+    return check_lanes(b.nodes, primitive_count, [](int c) { return c < 0; }, depth);
+}
+
+inline bool bvh_cache::check_nodes(const compressed_bvh& b, size_t primitive_count, int& depth) {
+    for (const auto& node : b.nodes)
+        for (int a = 0; a < 3; a++)
+            if (node.exponent[a] < -126)
+                return false;
+    return check_lanes(b.nodes, primitive_count,
+                       [](uint8_t c) { return c == compressed_bvh::empty_lane; }, depth);
+}
+
+
+template <typename T>
+inline bool bvh_cache::save(
+    const std::string& path, uint64_t key, const T& bvh, const std::vector<shared_ptr<hittable>>& objects
+) {
+    static_assert(std::is_trivially_copyable<typename decltype(bvh.nodes)::value_type>::value,
+                  "cached nodes are written as they are in memory");
+
+    std::unordered_map<const hittable*, uint32_t> index;
+    for (size_t i = 0; i < objects.size(); i++)
+        index[objects[i].get()] = static_cast<uint32_t>(i);
+
+    std::vector<uint32_t> slots(bvh.primitives.size());
+    for (size_t i = 0; i < slots.size(); i++) {
+        auto found = index.find(bvh.primitives[i]);
+        if (found == index.end())
+            return false;
+        slots[i] = found->second;
+    }
+
+    bvh_cache_header h{};
+    std::memcpy(h.magic, "rtbvh\0\0\0", sizeof(h.magic));
+    h.version = version;
+    h.layout = static_cast<uint32_t>(layout_of<T>());
+    h.key = key;
+    h.primitive_count = slots.size();
+    header_from(h, bvh);
+
+    // written alongside, then renamed over, so a reader never maps half a file
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        out.write(reinterpret_cast<const char*>(bvh.nodes.data()), h.node_count * h.node_size);
+        if constexpr (std::is_same<T, wide_bvh>::value)
+            out.write(reinterpret_cast<const char*>(bvh.motion.data()), h.motion_count * h.motion_size);
+        out.write(reinterpret_cast<const char*>(slots.data()), slots.size() * sizeof(uint32_t));
+
+        if (!out)
+            return false;
+    }
+
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+
+template <typename T>
+inline shared_ptr<T> bvh_cache::load(
+    const std::string& path, uint64_t key, const std::vector<shared_ptr<hittable>>& objects,
+    const bvh_options& options
+) {
+    mapped_file file(path);
+    if (file.size() < sizeof(bvh_cache_header))
+        return nullptr;
+
+    bvh_cache_header h;
+    std::memcpy(&h, file.data(), sizeof(h));
+
+    auto bvh = make_shared<T>();
+    bvh_cache_header expected{};
+    header_from(expected, *bvh);
+
+    if (std::memcmp(h.magic, "rtbvh\0\0\0", sizeof(h.magic)) != 0 || h.version != version
+        || h.layout != static_cast<uint32_t>(layout_of<T>()) || h.key != key
+        || h.node_size != expected.node_size || h.motion_size != expected.motion_size)
+        return nullptr;
+
+    // past the header, anything that doesn't add up is built again - and overwritten
+    auto damaged = [&path]() {
+        std::cerr << "BVH cache file " << path << " is damaged, building again.\n";
+        return nullptr;
+    };
+
+    // counts are checked against the file before they're multiplied, so nothing can wrap around
+    const size_t payload = file.size() - sizeof(h);
+    if (h.node_count == 0 || h.node_count > payload / h.node_size || h.primitive_count > payload / sizeof(uint32_t)
+        || (h.motion_size == 0 ? h.motion_count != 0 : h.motion_count > payload / h.motion_size))
+        return damaged();
+
+    size_t node_bytes = h.node_count * h.node_size;
+    size_t motion_bytes = h.motion_count * h.motion_size;
+    if (payload != node_bytes + motion_bytes + h.primitive_count * sizeof(uint32_t))
+        return damaged();
+
+    const unsigned char* p = file.data() + sizeof(h);
+
+    bvh->nodes.resize(h.node_count);
+    std::memcpy(bvh->nodes.data(), p, node_bytes);
+    p += node_bytes;
+
+    if constexpr (std::is_same<T, wide_bvh>::value) {
+        if (h.motion_count > 0) {
+            bvh->motion.resize(h.motion_count);
+            std::memcpy(bvh->motion.data(), p, motion_bytes);
+            p += motion_bytes;
+        }
+    }
+
+    const uint32_t* slots = reinterpret_cast<const uint32_t*>(p);
+    bvh->primitives.resize(h.primitive_count);
+    bvh->owned.resize(h.primitive_count);
+    for (size_t i = 0; i < h.primitive_count; i++) {
+        uint32_t slot;
+        std::memcpy(&slot, slots + i, sizeof(slot));
+        if (slot >= objects.size())
+            return damaged();
+        bvh->owned[i] = objects[slot];
+        bvh->primitives[i] = bvh->owned[i].get();
+    }
+
+    // the traversal stack is sized from the depth, so that's worked out here rather than read
+    int depth;
+    if (!check_nodes(*bvh, h.primitive_count, depth))
+        return damaged();
+    h.deepest = depth;
+
+    set_from(*bvh, h);
+    bvh->options = options;
+    return bvh;
+}
+
+
+// A flat layout over the list - from the cache in options.cache_dir when it has this one,
+// otherwise built, and saved there for next time.
+template <typename T>
+inline shared_ptr<hittable> cached_bvh(hittable_list& list, double time0, double time1, const bvh_options& options) {
+    if (options.cache_dir.empty())
+        return make_shared<T>(list, time0, time1, options);
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+    std::vector<shared_ptr<hittable>> opened;
+    const auto& objects = bvh_cache::primitives_of(list, opened);
+    uint64_t key = bvh_cache::key(list, objects, time0, time1, options);
+    std::string path = bvh_cache::path(options.cache_dir, key, options.layout);
+
+    if (auto cached = bvh_cache::load<T>(path, key, objects, options)) {
+        if (options.report) {
+            auto end_time = std::chrono::high_resolution_clock::now();
+            std::cout << "bvh over " << list.objects.size() << " objects loaded from " << path << " ("
+                      << cached->nodes.size() << " nodes) in "
+                      << std::chrono::duration<double, std::milli>(end_time - start_time).count() << "ms" << std::endl;
+        }
+        return cached;
+    }
+
+    auto built = make_shared<T>(list, time0, time1, options);
+
+    mkdir(options.cache_dir.c_str(), 0755);
+    if (bvh_cache::save(path, key, *built, objects) && options.report)
+        std::cout << "saved to " << path << std::endl;
+
+    return built;
+}
+
+
+#endif
@@ -0,0 +1,545 @@
+#ifndef COMPRESSED_BVH_H
+#define COMPRESSED_BVH_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable_list.h"
+#include "wide_bvh.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define COMPRESSED_BVH_SSE
+#endif
+
+
+// The 4-wide BVH again, with each node squeezed into one 64 byte cache line (a wide_bvh_node is
+// 128, a bvh_node over 100 for only two children). A node keeps its own box as a float origin
+// and a power of two step per axis, and its children's bounds as 8 bit multiples of the step -
+// rounded outward, so a decoded box can only be bigger than the child. Children and primitives
+// are 32 bit indices. A leaf with too many primitives for its 8 bit count (a list the builder
+// took as one object) is split over extra nodes.
+//
+// Encoding checks every bound against its float decode (origin + q * step), so rounding can't
+// shrink a box; the slab test folds that decode into the plane distances, with the same far end
+// slack as wide_bvh. Boxes cover the whole shutter interval - there's no room for motion bounds,
+// so moving objects are found through their swept boxes.
+
+struct alignas(64) compressed_bvh_node {
+    float origin[3];        // low corner of the node's box, rounded down
+    int8_t exponent[3];     // a step on each axis is 2^exponent
+    uint8_t count[4];       // primitives in a leaf child, 0 for interior, empty_lane for an unused slot
+    uint8_t bounds[6][4];   // children's min x, y, z then max x, y, z, in steps from the origin -
+                            // one lane per child
+    uint32_t child[4];      // node index (interior) or first primitive (leaf)
+};
+
+
+class compressed_bvh : public hittable {
+    public:
+        compressed_bvh() {}
+
+        // builds a bvh_node tree with the given options, then collapses and quantizes it
+        compressed_bvh(hittable_list& list, double time0, double time1,
+                       const bvh_options& options = bvh_options());
+
+        compressed_bvh(const shared_ptr<hittable>& tree, double time0, double time1,
+                       const bvh_options& options = bvh_options());
+
+        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+            return traverse<false>(r, t_min, t_max, &rec);
+        }
+
+        virtual bool occluded(const ray& r, double t_min, double t_max) const {
+            return traverse<true>(r, t_min, t_max, nullptr);
+        }
+
+        virtual bool bounding_box(double t0, double t1, aabb& output_box) const;
+
+        virtual void collect_lights(std::vector<const hittable*>& lights) const {
+            for (auto p : primitives)
+                p->collect_lights(lights);
+        }
+
+        virtual void refit(double time0, double time1);
+
+        size_t node_count() const { return nodes.size(); }
+
+        // SAH cost over the decoded child boxes, relative to the root box
+        double sah_cost() const;
+
+    public:
+        static const int width = 4;
+        static const int max_depth = 64;   // traversal stack kept on the C++ stack, deeper trees spill
+        static const uint8_t empty_lane = 255;
+
+        std::vector<compressed_bvh_node> nodes;
+        std::vector<const hittable*> primitives;
+        aabb root_box;
+
+    private:
+        template <bool any_hit>
+        bool traverse(const ray& r, double t_min, double t_max, hit_record* rec) const;
+
+        void build(const shared_ptr<hittable>& tree, double time0, double time1);
+
+        // returns the node's index, and the box around everything under it
+        int collapse(const shared_ptr<hittable>& h, double time0, double time1, int depth, aabb& box);
+        void sort_leaf(int first, int count, double time0, double time1);
+        int split_leaf(int first, int count, double time0, double time1, int depth, aabb& box);
+        void add_primitives(const shared_ptr<hittable>& h);
+        aabb leaf_box(int first, int count, double time0, double time1) const;
+
+        // quantizes a node's children's boxes against the box around them all
+        void encode(int index, const aabb* lanes, int used);
+        aabb decode(int index, int lane) const;
+
+        std::vector<shared_ptr<hittable>> owned;   // keeps the primitives alive
+        int deepest = 0;
+
+        bvh_options options;        // for refitting in parallel, and rebuilding
+        double built_cost = 0;      // SAH cost as last built
+        friend class bvh_cache;     // saves and restores all of the above
+};
+
+
+// 2^e as a float, straight from the bits
+inline float exponent_step(int e) {
+    uint32_t bits = static_cast<uint32_t>(e + 127) << 23;
+    float step;
+    std::memcpy(&step, &bits, sizeof(step));
+    return step;
+}
+
+
+inline compressed_bvh::compressed_bvh(
+    hittable_list& list, double time0, double time1, const bvh_options& options
+) : compressed_bvh(make_shared<bvh_node>(list, time0, time1, options), time0, time1, options) {
+    if (options.report)
+        std::cout << "compressed to " << nodes.size() << " " << width << "-wide nodes ("
+                  << nodes.size() * sizeof(compressed_bvh_node) / 1024 << "KB, "
+                  << sizeof(compressed_bvh_node) << " bytes each), depth " << deepest << std::endl;
+}
+
+
+inline compressed_bvh::compressed_bvh(
+    const shared_ptr<hittable>& tree, double time0, double time1, const bvh_options& options
+) : options(options) {
+    build(tree, time0, time1);
+}
+
+
+inline void compressed_bvh::build(const shared_ptr<hittable>& tree, double time0, double time1) {
+    nodes.clear();
+    primitives.clear();
+    owned.clear();
+    deepest = 0;
+
+    collapse(tree, time0, time1, 1, root_box);
+    built_cost = sah_cost();
+}
+
+
+inline void compressed_bvh::add_primitives(const shared_ptr<hittable>& h) {
+    if (auto list = std::dynamic_pointer_cast<hittable_list>(h)) {
+        for (const auto& object : list->objects)
+            add_primitives(object);
+    } else {
+        owned.push_back(h);
+        primitives.push_back(h.get());
+    }
+}
+
+
+inline aabb compressed_bvh::leaf_box(int first, int count, double time0, double time1) const {
+    aabb box;
+    for (int p = first; p < first + count; p++) {
+        aabb b;
+        primitives[p]->bounding_box(time0, time1, b);
+        box = p == first ? b : surrounding_box(box, b);
+    }
+    return box;
+}
+
+
+inline int compressed_bvh::collapse(
+    const shared_ptr<hittable>& h, double time0, double time1, int depth, aabb& box
+) {
+    deepest = std::max(deepest, depth);
+
+    auto children = wide_children(h, time0, time1, width);
+
+    int index = static_cast<int>(nodes.size());
+    nodes.emplace_back();
+
+    aabb lanes[width];
+    for (size_t i = 0; i < children.size(); i++) {
+        if (is_interior(children[i])) {
+            int c = collapse(children[i], time0, time1, depth + 1, lanes[i]);
+            nodes[index].child[i] = static_cast<uint32_t>(c);
+            nodes[index].count[i] = 0;
+        } else {
+            auto leaf = std::dynamic_pointer_cast<bvh_node>(children[i]);
+            int first = static_cast<int>(primitives.size());
+            add_primitives(leaf ? leaf->left : children[i]);
+            int count = static_cast<int>(primitives.size()) - first;
+
+            if (count >= empty_lane) {
+                sort_leaf(first, count, time0, time1);
+                int c = split_leaf(first, count, time0, time1, depth + 1, lanes[i]);
+                nodes[index].child[i] = static_cast<uint32_t>(c);
+                nodes[index].count[i] = 0;
+            } else {
+                nodes[index].child[i] = static_cast<uint32_t>(first);
+                nodes[index].count[i] = static_cast<uint8_t>(count);
+                lanes[i] = leaf_box(first, count, time0, time1);
+            }
+        }
+
+        box = i == 0 ? lanes[i] : surrounding_box(box, lanes[i]);
+    }
+
+    encode(index, lanes, static_cast<int>(children.size()));
+    return index;
+}
+
+
+// A leaf's primitives in order along the axis their centroids spread furthest on, so that
+// neighbours in the array are neighbours in space.
+inline void compressed_bvh::sort_leaf(int first, int count, double time0, double time1) {
+    std::vector<point3> centroid(count);
+    aabb spread;
+    for (int p = 0; p < count; p++) {
+        aabb b;
+        primitives[first + p]->bounding_box(time0, time1, b);
+        centroid[p] = 0.5 * (b.min() + b.max());
+        spread = p == 0 ? aabb(centroid[p], centroid[p]) : surrounding_box(spread, aabb(centroid[p], centroid[p]));
+    }
+
+    const int axis = spread.longest_axis();
+    std::vector<int> order(count);
+    for (int p = 0; p < count; p++)
+        order[p] = p;
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return centroid[a][axis] < centroid[b][axis]; });
+
+    std::vector<shared_ptr<hittable>> sorted(count);
+    for (int p = 0; p < count; p++)
+        sorted[p] = owned[first + order[p]];
+    for (int p = 0; p < count; p++) {
+        owned[first + p] = sorted[p];
+        primitives[first + p] = sorted[p].get();
+    }
+}
+
+
+// A leaf too big for an 8 bit count - a list the builder took as one object, opened up by
+// add_primitives. Its sorted primitives are shared out between the lanes of a new node, and
+// shares still too big get nodes of their own, as many levels down as it takes.
+inline int compressed_bvh::split_leaf(int first, int count, double time0, double time1, int depth, aabb& box) {
+    deepest = std::max(deepest, depth);
+
+    int index = static_cast<int>(nodes.size());
+    nodes.emplace_back();
+
+    aabb lanes[width];
+    const int share = (count + width - 1) / width;
+    int used = 0;
+    for (int begin = first; begin < first + count; begin += share, used++) {
+        int n = std::min(share, first + count - begin);
+        if (n >= empty_lane) {
+            int c = split_leaf(begin, n, time0, time1, depth + 1, lanes[used]);
+            nodes[index].child[used] = static_cast<uint32_t>(c);
+            nodes[index].count[used] = 0;
+        } else {
+            nodes[index].child[used] = static_cast<uint32_t>(begin);
+            nodes[index].count[used] = static_cast<uint8_t>(n);
+            lanes[used] = leaf_box(begin, n, time0, time1);
+        }
+
+        box = used == 0 ? lanes[used] : surrounding_box(box, lanes[used]);
+    }
+
+    encode(index, lanes, used);
+    return index;
+}
+
+
+inline void compressed_bvh::encode(int index, const aabb* lanes, int used) {
+    compressed_bvh_node& n = nodes[index];
+
+    aabb box = lanes[0];
+    for (int i = 1; i < used; i++)
+        box = surrounding_box(box, lanes[i]);
+
+    for (int a = 0; a < 3; a++) {
+        const float origin = std::nextafter(static_cast<float>(box.min()[a]), -FLT_MAX);
+
+        // smallest step that reaches the far side in 255 of them
+        double extent = box.max()[a] - origin;
+        int e = extent > 0 ? static_cast<int>(std::ceil(std::log2(extent / 255))) : -126;
+        e = std::max(-126, std::min(127, e));
+        while (e < 127 && origin + 255.0f * exponent_step(e) < box.max()[a])
+            e++;
+
+        n.origin[a] = origin;
+        n.exponent[a] = static_cast<int8_t>(e);
+        const float step = exponent_step(e);
+
+        for (int i = 0; i < width; i++) {
+            if (i >= used) {
+                n.bounds[a][i] = 255;
+                n.bounds[a + 3][i] = 0;
+                continue;
+            }
+
+            int q_lo = static_cast<int>(std::floor((lanes[i].min()[a] - origin) / step));
+            int q_hi = static_cast<int>(std::ceil((lanes[i].max()[a] - origin) / step));
+            q_lo = std::max(0, std::min(255, q_lo));
+            q_hi = std::max(0, std::min(255, q_hi));
+
+            // the division was in double - walk outward until the float decode covers the child
+            while (q_lo > 0 && origin + static_cast<float>(q_lo) * step > lanes[i].min()[a])
+                q_lo--;
+            while (q_hi < 255 && origin + static_cast<float>(q_hi) * step < lanes[i].max()[a])
+                q_hi++;
+
+            n.bounds[a][i] = static_cast<uint8_t>(q_lo);
+            n.bounds[a + 3][i] = static_cast<uint8_t>(q_hi);
+        }
+    }
+
+    for (int i = used; i < width; i++) {
+        n.child[i] = 0;
+        n.count[i] = empty_lane;
+    }
+}
+
+
+inline aabb compressed_bvh::decode(int index, int lane) const {
+    const compressed_bvh_node& n = nodes[index];
+    point3 min, max;
+    for (int a = 0; a < 3; a++) {
+        const float step = exponent_step(n.exponent[a]);
+        min[a] = n.origin[a] + static_cast<float>(n.bounds[a][lane]) * step;
+        max[a] = n.origin[a] + static_cast<float>(n.bounds[a + 3][lane]) * step;
+    }
+    return aabb(min, max);
+}
+
+
+#ifdef COMPRESSED_BVH_SSE
+// four 8 bit lanes out to four floats
+inline __m128 unpack_lanes(const uint8_t q[4]) {
+    int32_t bits;
+    std::memcpy(&bits, q, sizeof(bits));
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bits), zero);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+}
+#endif
+
+
+template <bool any_hit>
+inline bool compressed_bvh::traverse(const ray& r, double t_min, double t_max, hit_record* rec) const {
+    if (nodes.empty())
+        return false;
+
+    const float origin[3] = {
+        static_cast<float>(r.origin().x()), static_cast<float>(r.origin().y()), static_cast<float>(r.origin().z())
+    };
+    const float inv_dir[3] = {
+        static_cast<float>(1.0 / r.direction().x()),
+        static_cast<float>(1.0 / r.direction().y()),
+        static_cast<float>(1.0 / r.direction().z())
+    };
+    // rows of compressed_bvh_node::bounds holding each axis' near and far planes for this ray
+    int near_row[3], far_row[3];
+    for (int a = 0; a < 3; a++) {
+        near_row[a] = inv_dir[a] < 0 ? a + 3 : a;
+        far_row[a]  = inv_dir[a] < 0 ? a : a + 3;
+    }
+
+    bool hit_anything = false;
+    double closest = t_max;
+
+    bvh_stack<max_depth * (width - 1) + 1> stack(deepest * (width - 1) + 1);
+    stack.push(0);
+
+#ifdef COMPRESSED_BVH_SSE
+    const __m128 t_lo = _mm_set1_ps(static_cast<float>(t_min));
+#endif
+
+    while (!stack.empty()) {
+        const int index = stack.pop();
+        const compressed_bvh_node& node = nodes[index];
+
+        // a little slack on the far end, for the rounding in the float slab test
+        const float t_hi = static_cast<float>(closest) * 1.0001f;
+
+        float t_enter[width];
+        int mask = 0;
+
+#ifdef COMPRESSED_BVH_SSE
+        // a plane at origin + q * step is crossed at q * (step / d) + (origin - o) / d, so
+        // each axis is one multiply and add per bound
+        __m128 t0 = t_lo;
+        __m128 t1 = _mm_set1_ps(t_hi);
+        for (int a = 0; a < 3; a++) {
+            const __m128 scale = _mm_set1_ps(exponent_step(node.exponent[a]) * inv_dir[a]);
+            const __m128 offset = _mm_set1_ps((node.origin[a] - origin[a]) * inv_dir[a]);
+            __m128 t_near = _mm_add_ps(_mm_mul_ps(unpack_lanes(node.bounds[near_row[a]]), scale), offset);
+            __m128 t_far  = _mm_add_ps(_mm_mul_ps(unpack_lanes(node.bounds[far_row[a]]), scale), offset);
+            t0 = _mm_max_ps(t_near, t0);
+            t1 = _mm_min_ps(t_far, t1);
+        }
+        mask = _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+        _mm_storeu_ps(t_enter, t0);
+#else
+        for (int i = 0; i < width; i++) {
+            float t0 = static_cast<float>(t_min), t1 = t_hi;
+            for (int a = 0; a < 3; a++) {
+                const float step = exponent_step(node.exponent[a]);
+                float b_near = node.origin[a] + static_cast<float>(node.bounds[near_row[a]][i]) * step;
+                float b_far  = node.origin[a] + static_cast<float>(node.bounds[far_row[a]][i]) * step;
+                float t_near = (b_near - origin[a]) * inv_dir[a];
+                float t_far  = (b_far - origin[a]) * inv_dir[a];
+                t0 = t_near > t0 ? t_near : t0;
+                t1 = t_far < t1 ? t_far : t1;
+            }
+            t_enter[i] = t0;
+            if (t0 <= t1)
+                mask |= 1 << i;
+        }
+#endif
+
+        // leaves are intersected right away, interior children pushed far to near
+        int interior[width];
+        int num_interior = 0;
+
+        for (int i = 0; i < width; i++) {
+            if (!(mask & (1 << i)) || node.count[i] == empty_lane)
+                continue;
+
+            if (node.count[i] == 0) {
+                interior[num_interior++] = i;
+                continue;
+            }
+
+            for (uint32_t p = node.child[i]; p < node.child[i] + node.count[i]; p++) {
+                if constexpr (any_hit) {
+                    if (primitives[p]->occluded(r, t_min, closest))
+                        return true;
+                } else if (primitives[p]->hit(r, t_min, closest, *rec)) {
+                    hit_anything = true;
+                    closest = rec->t;
+                }
+            }
+        }
+
+        // sort by entry distance, nearest last so it comes off the stack first
+        for (int i = 1; i < num_interior; i++)
+            for (int j = i; j > 0 && t_enter[interior[j]] > t_enter[interior[j-1]]; j--)
+                std::swap(interior[j], interior[j-1]);
+
+        for (int i = 0; i < num_interior; i++)
+            stack.push(static_cast<int>(node.child[interior[i]]));
+    }
+
+    return hit_anything;
+}
+
+
+inline void compressed_bvh::refit(double time0, double time1) {
+    if (nodes.empty())
+        return;
+
+    bvh_parallel_for(options, owned.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            owned[i]->refit(time0, time1);
+    });
+
+    // leaf lanes in parallel, then interior lanes and the quantization bottom up, a subtree
+    // per task
+    std::vector<aabb> lanes(nodes.size() * width);
+    bvh_parallel_for(options, nodes.size(), [&](size_t begin, size_t end) {
+        for (size_t n = begin; n < end; n++)
+            for (int i = 0; i < width; i++)
+                if (nodes[n].count[i] != 0 && nodes[n].count[i] != empty_lane)
+                    lanes[n * width + i] = leaf_box(static_cast<int>(nodes[n].child[i]), nodes[n].count[i],
+                                                    time0, time1);
+    });
+
+    std::vector<aabb> boxes(nodes.size());
+    auto children = [&](size_t n, auto f) {
+        for (int i = 0; i < width && nodes[n].count[i] != empty_lane; i++)
+            if (nodes[n].count[i] == 0)
+                f(static_cast<size_t>(nodes[n].child[i]));
+    };
+    bvh_refit_interior(options, nodes.size(), children, [&](size_t n) {
+        int used = 0;
+        for (int i = 0; i < width && nodes[n].count[i] != empty_lane; i++, used++) {
+            aabb& lane = lanes[n * width + i];
+            if (nodes[n].count[i] == 0)
+                lane = boxes[nodes[n].child[i]];
+            boxes[n] = i == 0 ? lane : surrounding_box(boxes[n], lane);
+        }
+        encode(static_cast<int>(n), &lanes[n * width], used);
+    });
+    root_box = boxes[0];
+
+    double cost = sah_cost();
+    if (cost > built_cost * (1 + options.rebuild_threshold)) {
+        hittable_list list;
+        list.objects = owned;
+
+        bvh_options rebuild_options = options;
+        rebuild_options.report = false;
+        build(make_shared<bvh_node>(list, time0, time1, rebuild_options), time0, time1);
+
+        if (options.report)
+            std::cout << "refit SAH cost " << cost << " was past " << 1 + options.rebuild_threshold
+                      << "x the built tree's, rebuilt over " << list.objects.size()
+                      << " objects, SAH cost now " << built_cost << std::endl;
+    }
+}
+
+
+inline double compressed_bvh::sah_cost() const {
+    if (nodes.empty())
+        return 0;
+
+    const double root_area = root_box.area();
+
+    double cost = options.traversal_cost;
+    for (size_t n = 0; n < nodes.size(); n++) {
+        for (int i = 0; i < width && nodes[n].count[i] != empty_lane; i++) {
+            double p = root_area > 0 ? decode(static_cast<int>(n), i).area() / root_area : 1;
+            cost += nodes[n].count[i] == 0 ? options.traversal_cost * p
+                                           : options.intersection_cost * p * nodes[n].count[i];
+        }
+    }
+
+    return cost;
+}
+
+
+inline bool compressed_bvh::bounding_box(double t0, double t1, aabb& output_box) const {
+    output_box = root_box;
+    return !nodes.empty();
+}
+
+
+#endif
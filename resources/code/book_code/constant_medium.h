@@ -32,6 +32,8 @@ class constant_medium : public hittable  {
             return boundary->bounding_box(t0, t1, output_box);
         }
 
+        virtual void refit(double time0, double time1) { boundary->refit(time0, time1); }
+
     public:
         shared_ptr<hittable> boundary;
         shared_ptr<material> phase_function;
@@ -81,7 +83,8 @@ inline bool constant_medium::hit(const ray& r, double t_min, double t_max, hit_r
 
     rec.normal = vec3(1,0,0);  // arbitrary
     rec.front_face = true;     // also arbitrary
-    rec.mat_ptr = phase_function;
+    rec.mat_ptr = phase_function.get();
+    rec.prim = nullptr;     // already complete
 
     return true;
 }
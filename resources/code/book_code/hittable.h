@@ -15,8 +15,11 @@
 
 #include "aabb.h"
 
+#include <vector>
+
 
 class material;
+class hittable;
 
 inline void get_sphere_uv(const point3& p, double& u, double& v) {
     auto phi = atan2(p.z(), p.x());
@@ -26,19 +29,48 @@ inline void get_sphere_uv(const point3& p, double& u, double& v) {
 }
 
 
+// Hit records are written for every accepted intersection and copied around freely, so the
+// material is a plain non-owning pointer - the primitive that was hit keeps it alive.
+//
+// Primitives only fill in t, the material and prim when they accept a hit. The rest (p, normal,
+// front_face, u, v) is left for evaluate_surface() once the closest hit is known. prim is null
+// once the record is complete.
+//
+// Wrappers (translate, rotate_y, flip_face, instance) leave their transform for then too: wrap()
+// stacks the prim their child hit and puts the wrapper in its place, and the wrapper's
+// get_surface() takes it back off with unwrap(), finishes the child's surface and transforms it.
+// So until it's evaluated, prim is the outermost wrapper around what was hit - the object
+// collect_lights() hands out for it.
 struct hit_record {
+    static const int max_wrapped = 4;   // deeper nesting finishes the inner surfaces as it goes
+
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat_ptr;
+    const material* mat_ptr;
+    const hittable* prim = nullptr;
     double t;
-    double u;
-    double v;
+    double u = 0;
+    double v = 0;
     bool front_face;
 
+    // what the wrappers' children hit, innermost first - only the top wrapped entries belong to
+    // prim when it's the wrapper that pushed the last one (outer)
+    int wrapped = 0;
+    const hittable* outer = nullptr;
+    const hittable* inner[max_wrapped];
+
     inline void set_face_normal(const ray& r, const vec3& outward_normal) {
         front_face = dot(r.direction(), outward_normal) < 0;
         normal = front_face ? outward_normal :-outward_normal;
     }
+
+    // child_r is the ray the wrapper's child was hit with
+    inline void wrap(const hittable* wrapper, const ray& child_r);
+
+    inline void unwrap() {
+        prim = inner[--wrapped];
+        outer = wrapped > 0 ? prim : nullptr;
+    }
 };
 
 
@@ -46,9 +78,63 @@ class hittable {
     public:
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
         virtual bool bounding_box(double t0, double t1, aabb& output_box) const = 0;
+
+        // Any-hit query, for visibility - true if anything is hit within (t_min, t_max). Stops at
+        // the first intersection it finds and fills in nothing, so it's cheaper than hit().
+        virtual bool occluded(const ray& r, double t_min, double t_max) const {
+            hit_record rec;
+            return hit(r, t_min, t_max, rec);
+        }
+
+        // fills in the surface at rec.t, for a hit this object accepted with prim set
+        virtual void get_surface(const ray& r, hit_record& rec) const {}
+
+        // Recomputes any boxes cached from what's underneath, after it has moved (an animation
+        // frame) - objects that work their box out when asked have nothing to do.
+        virtual void refit(double time0, double time1) {}
+
+        // Light sampling, for next event estimation: random() picks a direction from o towards
+        // somewhere on the object, and pdf_value() is the solid angle density of it picking v.
+        // Objects that can't be sampled give a zero direction and a density of zero.
+        virtual double pdf_value(const point3& o, const vec3& v) const { return 0.0; }
+        virtual vec3 random(const point3& o) const { return vec3(0,0,0); }
+
+        // adds whatever in here emits, as the objects its light should be sampled through
+        virtual void collect_lights(std::vector<const hittable*>& lights) const {}
 };
 
 
+// wrappers are sampled as a whole when anything inside them emits
+inline void collect_lights_through(
+    const hittable* wrapper, const hittable& inner, std::vector<const hittable*>& lights
+) {
+    std::vector<const hittable*> inner_lights;
+    inner.collect_lights(inner_lights);
+    if (!inner_lights.empty())
+        lights.push_back(wrapper);
+}
+
+
+inline void evaluate_surface(const ray& r, hit_record& rec) {
+    if (rec.prim) {
+        const hittable* prim = rec.prim;
+        rec.prim = nullptr;
+        prim->get_surface(r, rec);
+    }
+}
+
+
+inline void hit_record::wrap(const hittable* wrapper, const ray& child_r) {
+    if (outer != prim)
+        wrapped = 0;    // left from a hit this one replaced
+    if (wrapped == max_wrapped)
+        evaluate_surface(child_r, *this);   // nested too deep - finishing it empties the stack
+
+    inner[wrapped++] = prim;
+    prim = outer = wrapper;
+}
+
+
 class flip_face : public hittable {
     public:
         flip_face(shared_ptr<hittable> p) : ptr(p) {}
@@ -57,14 +143,33 @@ class flip_face : public hittable {
             if (!ptr->hit(r, t_min, t_max, rec))
                 return false;
 
-            rec.front_face = !rec.front_face;
+            rec.wrap(this, r);
             return true;
         }
 
+        virtual void get_surface(const ray& r, hit_record& rec) const {
+            rec.unwrap();
+            evaluate_surface(r, rec);
+            rec.front_face = !rec.front_face;
+        }
+
         virtual bool bounding_box(double t0, double t1, aabb& output_box) const {
             return ptr->bounding_box(t0, t1, output_box);
         }
 
+        virtual bool occluded(const ray& r, double t_min, double t_max) const {
+            return ptr->occluded(r, t_min, t_max);
+        }
+
+        virtual void refit(double time0, double time1) { ptr->refit(time0, time1); }
+
+        virtual double pdf_value(const point3& o, const vec3& v) const { return ptr->pdf_value(o, v); }
+        virtual vec3 random(const point3& o) const { return ptr->random(o); }
+
+        virtual void collect_lights(std::vector<const hittable*>& lights) const {
+            collect_lights_through(this, *ptr, lights);
+        }
+
     public:
         shared_ptr<hittable> ptr;
 };
@@ -78,6 +183,27 @@ class translate : public hittable {
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const;
         virtual bool bounding_box(double t0, double t1, aabb& output_box) const;
 
+        virtual bool occluded(const ray& r, double t_min, double t_max) const {
+            return ptr->occluded(moved_ray(r), t_min, t_max);
+        }
+
+        // the child's surface, from the moved ray, moved back out
+        virtual void get_surface(const ray& r, hit_record& rec) const;
+
+        ray moved_ray(const ray& r) const { return ray(r.origin() - offset, r.direction(), r.time()); }
+
+        virtual void refit(double time0, double time1) { ptr->refit(time0, time1); }
+
+        virtual double pdf_value(const point3& o, const vec3& v) const {
+            return ptr->pdf_value(o - offset, v);
+        }
+
+        virtual vec3 random(const point3& o) const { return ptr->random(o - offset); }
+
+        virtual void collect_lights(std::vector<const hittable*>& lights) const {
+            collect_lights_through(this, *ptr, lights);
+        }
+
     public:
         shared_ptr<hittable> ptr;
         vec3 offset;
@@ -85,17 +211,25 @@ class translate : public hittable {
 
 
 inline bool translate::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    ray moved_r(r.origin() - offset, r.direction(), r.time());
+    ray moved_r = moved_ray(r);
     if (!ptr->hit(moved_r, t_min, t_max, rec))
         return false;
 
-    rec.p += offset;
-    rec.set_face_normal(moved_r, rec.normal);
+    rec.wrap(this, moved_r);
 
     return true;
 }
 
 
+inline void translate::get_surface(const ray& r, hit_record& rec) const {
+    rec.unwrap();
+    ray moved_r = moved_ray(r);
+    evaluate_surface(moved_r, rec);
+    rec.p += offset;
+    rec.set_face_normal(moved_r, rec.normal);
+}
+
+
 inline bool translate::bounding_box(double t0, double t1, aabb& output_box) const {
     if (!ptr->bounding_box(t0, t1, output_box))
         return false;
@@ -118,6 +252,44 @@ class rotate_y : public hittable {
             return hasbox;
         }
 
+        virtual bool occluded(const ray& r, double t_min, double t_max) const {
+            return ptr->occluded(rotated_ray(r), t_min, t_max);
+        }
+
+        // the child's surface, from the rotated ray, rotated back out
+        virtual void get_surface(const ray& r, hit_record& rec) const;
+
+        ray rotated_ray(const ray& r) const {
+            return ray(to_object(r.origin()), to_object(r.direction()), r.time());
+        }
+
+        virtual void refit(double time0, double time1) {
+            ptr->refit(time0, time1);
+            update_box(time0, time1);
+        }
+
+        // the box around the rotated object's box
+        void update_box(double time0, double time1);
+
+        virtual double pdf_value(const point3& o, const vec3& v) const {
+            return ptr->pdf_value(to_object(o), to_object(v));
+        }
+
+        virtual vec3 random(const point3& o) const { return to_world(ptr->random(to_object(o))); }
+
+        virtual void collect_lights(std::vector<const hittable*>& lights) const {
+            collect_lights_through(this, *ptr, lights);
+        }
+
+        // rotations between world space and the wrapped object's space
+        vec3 to_object(const vec3& w) const {
+            return vec3(cos_theta*w[0] - sin_theta*w[2], w[1], sin_theta*w[0] + cos_theta*w[2]);
+        }
+
+        vec3 to_world(const vec3& o) const {
+            return vec3(cos_theta*o[0] + sin_theta*o[2], o[1], -sin_theta*o[0] + cos_theta*o[2]);
+        }
+
     public:
         shared_ptr<hittable> ptr;
         double sin_theta;
@@ -131,7 +303,12 @@ inline rotate_y::rotate_y(shared_ptr<hittable> p, double angle) : ptr(p) {
     auto radians = degrees_to_radians(angle);
     sin_theta = sin(radians);
     cos_theta = cos(radians);
-    hasbox = ptr->bounding_box(0, 1, bbox);
+    update_box(0, 1);
+}
+
+
+inline void rotate_y::update_box(double time0, double time1) {
+    hasbox = ptr->bounding_box(time0, time1, bbox);
 
     point3 min( infinity,  infinity,  infinity);
     point3 max(-infinity, -infinity, -infinity);
@@ -161,20 +338,20 @@ inline rotate_y::rotate_y(shared_ptr<hittable> p, double angle) : ptr(p) {
 
 
 inline bool rotate_y::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    point3 origin = r.origin();
-    vec3 direction = r.direction();
-
-    origin[0] = cos_theta*r.origin()[0] - sin_theta*r.origin()[2];
-    origin[2] = sin_theta*r.origin()[0] + cos_theta*r.origin()[2];
+    ray rotated_r = rotated_ray(r);
+    if (!ptr->hit(rotated_r, t_min, t_max, rec))
+        return false;
 
-    direction[0] = cos_theta*r.direction()[0] - sin_theta*r.direction()[2];
-    direction[2] = sin_theta*r.direction()[0] + cos_theta*r.direction()[2];
+    rec.wrap(this, rotated_r);
 
-    ray rotated_r(origin, direction, r.time());
+    return true;
+}
 
-    if (!ptr->hit(rotated_r, t_min, t_max, rec))
-        return false;
 
+inline void rotate_y::get_surface(const ray& r, hit_record& rec) const {
+    rec.unwrap();
+    ray rotated_r = rotated_ray(r);
+    evaluate_surface(rotated_r, rec);
     point3 p = rec.p;
     vec3 normal = rec.normal;
 
@@ -186,8 +363,6 @@ inline bool rotate_y::hit(const ray& r, double t_min, double t_max, hit_record&
 
     rec.p = p;
     rec.set_face_normal(rotated_r, normal);
-
-    return true;
 }
 
 
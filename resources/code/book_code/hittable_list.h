@@ -29,21 +29,42 @@ class hittable_list: public hittable  {
         virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const;
         virtual bool bounding_box(double t0, double t1, aabb& output_box) const;
 
+        virtual bool occluded(const ray& r, double t_min, double t_max) const {
+            for (const auto& object : objects)
+                if (object->occluded(r, t_min, t_max))
+                    return true;
+            return false;
+        }
+
+        virtual void refit(double time0, double time1) {
+            for (const auto& object : objects)
+                object->refit(time0, time1);
+        }
+
+        // sampled as an even mixture of the objects in it
+        virtual double pdf_value(const point3& o, const vec3& v) const;
+        virtual vec3 random(const point3& o) const;
+
+        virtual void collect_lights(std::vector<const hittable*>& lights) const {
+            for (const auto& object : objects)
+                object->collect_lights(lights);
+        }
+
     public:
         std::vector<shared_ptr<hittable>> objects;
 };
 
 
+// Objects only write to rec when they hit (the BVH relies on that too), so each closer hit
+// can go straight into it rather than through a temporary.
 inline bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    hit_record temp_rec;
     auto hit_anything = false;
     auto closest_so_far = t_max;
 
     for (const auto& object : objects) {
-        if (object->hit(r, t_min, closest_so_far, temp_rec)) {
+        if (object->hit(r, t_min, closest_so_far, rec)) {
             hit_anything = true;
-            closest_so_far = temp_rec.t;
-            rec = temp_rec;
+            closest_so_far = rec.t;
         }
     }
 
@@ -67,4 +88,22 @@ inline bool hittable_list::bounding_box(double t0, double t1, aabb& output_box)
 }
 
 
+inline double hittable_list::pdf_value(const point3& o, const vec3& v) const {
+    if (objects.empty()) return 0.0;
+
+    auto sum = 0.0;
+    for (const auto& object : objects)
+        sum += object->pdf_value(o, v);
+
+    return sum / objects.size();
+}
+
+
+inline vec3 hittable_list::random(const point3& o) const {
+    if (objects.empty()) return vec3(0,0,0);
+
+    return objects[random_int(0, static_cast<int>(objects.size()) - 1)]->random(o);
+}
+
+
 #endif
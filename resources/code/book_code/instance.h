@@ -0,0 +1,118 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "transform.h"
+
+
+// A placement of a shared object - usually a BVH built once (the bottom level) - under an
+// affine transform. Rays are taken into the object's space with the cached inverse, so any
+// number of instances can share one copy of the geometry, and a BVH over the instances'
+// world space boxes makes the top level of a two level acceleration structure.
+//
+// The direction isn't renormalized in object space, so t means the same thing on both sides.
+
+class instance : public hittable {
+    public:
+        instance(shared_ptr<hittable> object, const affine& transform);
+
+        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const;
+
+        virtual bool occluded(const ray& r, double t_min, double t_max) const {
+            return object->occluded(to_object_ray(r), t_min, t_max);
+        }
+
+        // the object's surface, from the object space ray, taken out to world space
+        virtual void get_surface(const ray& r, hit_record& rec) const;
+
+        // the object is shared between instances, so whoever animates it refits it, once -
+        // an instance only follows its own transform
+        virtual void refit(double time0, double time1) { update_box(time0, time1); }
+
+        // moves the instance - its box catches up at the next refit()
+        void set_transform(const affine& transform) {
+            to_world = transform;
+            to_object = transform.inverse();
+        }
+
+        void update_box(double time0, double time1) {
+            aabb object_box;
+            hasbox = object->bounding_box(time0, time1, object_box);
+            if (hasbox)
+                bbox = to_world.box(object_box);
+        }
+
+        virtual bool bounding_box(double t0, double t1, aabb& output_box) const {
+            output_box = bbox;
+            return hasbox;
+        }
+
+        virtual double pdf_value(const point3& o, const vec3& v) const {
+            return object->pdf_value(to_object.point(o), to_object.vector(v));
+        }
+
+        virtual vec3 random(const point3& o) const {
+            return to_world.vector(object->random(to_object.point(o)));
+        }
+
+        // solid angle densities only carry over through a similarity - emitters under other
+        // transforms are left to be found by scattering
+        virtual void collect_lights(std::vector<const hittable*>& lights) const {
+            if (to_world.is_similarity())
+                collect_lights_through(this, *object, lights);
+        }
+
+        ray to_object_ray(const ray& r) const {
+            return ray(to_object.point(r.origin()), to_object.vector(r.direction()), r.time());
+        }
+
+    public:
+        shared_ptr<hittable> object;
+        affine to_world;
+        affine to_object;
+        bool hasbox;
+        aabb bbox;
+};
+
+
+inline instance::instance(shared_ptr<hittable> p, const affine& transform)
+    : object(p), to_world(transform), to_object(transform.inverse())
+{
+    update_box(0, 1);
+}
+
+
+inline bool instance::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    ray object_r = to_object_ray(r);
+    if (!object->hit(object_r, t_min, t_max, rec))
+        return false;
+
+    rec.wrap(this, object_r);
+
+    return true;
+}
+
+
+inline void instance::get_surface(const ray& r, hit_record& rec) const {
+    rec.unwrap();
+    ray object_r = to_object_ray(r);
+
+    // the normal already faces against the object space ray, and the inverse transpose
+    // keeps it facing against the world space one - front_face carries straight over
+    evaluate_surface(object_r, rec);
+    rec.p = to_world.point(rec.p);
+    rec.normal = unit_vector(to_object.transpose_vector(rec.normal));
+}
+
+
+#endif
@@ -0,0 +1,332 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable_list.h"
+
+#include <vector>
+
+
+// A bvh_node tree compiled down to one contiguous array of nodes, in depth first order. An
+// interior node's first child is the next node in the array and `offset` holds the index of the
+// second; a leaf's `offset` is the index of its first primitive. Traversal is a loop over a small
+// explicit stack, visiting the child nearer the ray origin first so the far one can be culled by
+// the closest hit so far.
+//
+// refit() recomputes the boxes over the same nodes after an animation frame, and rebuilds
+// once the SAH cost has grown past the options' rebuild_threshold.
+
+struct linear_bvh_node {
+    point3 box_min;
+    point3 box_max;
+    int offset;     // second child (interior) or first primitive (leaf)
+    int count;      // number of primitives, zero for interior nodes
+    int axis;       // axis the children were split on - first child has the lower centroid
+};
+
+
+class linear_bvh : public hittable {
+    public:
+        linear_bvh() {}
+
+        // builds a bvh_node tree with the given options, then flattens it
+        linear_bvh(hittable_list& list, double time0, double time1,
+                   const bvh_options& options = bvh_options());
+
+        linear_bvh(const shared_ptr<hittable>& tree, double time0, double time1,
+                   const bvh_options& options = bvh_options());
+
+        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+            return traverse<false>(r, t_min, t_max, &rec);
+        }
+
+        virtual bool occluded(const ray& r, double t_min, double t_max) const {
+            return traverse<true>(r, t_min, t_max, nullptr);
+        }
+
+        virtual bool bounding_box(double t0, double t1, aabb& output_box) const;
+
+        virtual void collect_lights(std::vector<const hittable*>& lights) const {
+            for (auto p : primitives)
+                p->collect_lights(lights);
+        }
+
+        virtual void refit(double time0, double time1);
+
+        size_t node_count() const { return nodes.size(); }
+
+        // SAH cost over the node boxes, relative to the root's
+        double sah_cost() const;
+
+    public:
+        static const int max_depth = 64;   // traversal stack kept on the C++ stack, deeper trees spill
+
+        std::vector<linear_bvh_node> nodes;
+        std::vector<const hittable*> primitives;
+
+    private:
+        // closest hit into rec - or with any_hit, returns at the first hit found and rec is unused
+        template <bool any_hit>
+        bool traverse(const ray& r, double t_min, double t_max, hit_record* rec) const;
+
+        void build(const shared_ptr<hittable>& tree, double time0, double time1);
+        void flatten(const shared_ptr<hittable>& h, double time0, double time1, int depth);
+        void add_primitives(const shared_ptr<hittable>& h);
+
+        std::vector<shared_ptr<hittable>> owned;   // keeps the primitives alive
+        int deepest = 0;
+
+        bvh_options options;        // for refitting in parallel, and rebuilding
+        double built_cost = 0;      // SAH cost as last built
+        friend class bvh_cache;     // saves and restores all of the above
+};
+
+
+inline linear_bvh::linear_bvh(
+    hittable_list& list, double time0, double time1, const bvh_options& options
+) : linear_bvh(make_shared<bvh_node>(list, time0, time1, options), time0, time1, options) {
+    if (options.report)
+        std::cout << "flattened to " << nodes.size() << " nodes ("
+                  << nodes.size() * sizeof(linear_bvh_node) / 1024 << "KB), depth "
+                  << deepest << std::endl;
+}
+
+
+inline linear_bvh::linear_bvh(
+    const shared_ptr<hittable>& tree, double time0, double time1, const bvh_options& options
+) : options(options) {
+    build(tree, time0, time1);
+}
+
+
+inline void linear_bvh::build(const shared_ptr<hittable>& tree, double time0, double time1) {
+    nodes.clear();
+    primitives.clear();
+    owned.clear();
+    deepest = 0;
+
+    flatten(tree, time0, time1, 1);
+    built_cost = sah_cost();
+}
+
+
+// A leaf's objects - the lists the SAH builder makes leaves out of are opened up, so every
+// primitive gets its own slot.
+inline void linear_bvh::add_primitives(const shared_ptr<hittable>& h) {
+    if (auto list = std::dynamic_pointer_cast<hittable_list>(h)) {
+        for (const auto& object : list->objects)
+            add_primitives(object);
+    } else {
+        owned.push_back(h);
+        primitives.push_back(h.get());
+    }
+}
+
+
+inline void linear_bvh::flatten(const shared_ptr<hittable>& h, double time0, double time1, int depth) {
+    deepest = std::max(deepest, depth);
+
+    aabb box;
+    if (!h->bounding_box(time0, time1, box))
+        std::cerr << "No bounding box in linear_bvh constructor.\n";
+
+    size_t index = nodes.size();
+    nodes.push_back(linear_bvh_node{box.min(), box.max(), 0, 0, 0});
+
+    auto node = std::dynamic_pointer_cast<bvh_node>(h);
+    if (!node || node->left == node->right) {
+        nodes[index].offset = static_cast<int>(primitives.size());
+        add_primitives(node ? node->left : h);
+        nodes[index].count = static_cast<int>(primitives.size()) - nodes[index].offset;
+        return;
+    }
+
+    // order the children along the axis their centroids are furthest apart on
+    aabb box_left, box_right;
+    node->left->bounding_box(time0, time1, box_left);
+    node->right->bounding_box(time0, time1, box_right);
+    vec3 separation = (box_right.min() + box_right.max()) - (box_left.min() + box_left.max());
+
+    int axis = 0;
+    for (int a = 1; a < 3; a++)
+        if (fabs(separation[a]) > fabs(separation[axis]))
+            axis = a;
+
+    auto first = node->left;
+    auto second = node->right;
+    if (separation[axis] < 0)
+        std::swap(first, second);
+
+    nodes[index].axis = axis;
+    flatten(first, time0, time1, depth + 1);
+    nodes[index].offset = static_cast<int>(nodes.size());
+    flatten(second, time0, time1, depth + 1);
+}
+
+
+template <bool any_hit>
+inline bool linear_bvh::traverse(const ray& r, double t_min, double t_max, hit_record* rec) const {
+    if (nodes.empty())
+        return false;
+
+    const point3 origin = r.origin();
+    const vec3 inv_dir(1.0 / r.direction().x(), 1.0 / r.direction().y(), 1.0 / r.direction().z());
+    const bool dir_is_neg[3] = { inv_dir.x() < 0, inv_dir.y() < 0, inv_dir.z() < 0 };
+
+    bool hit_anything = false;
+    double closest = t_max;
+
+    bvh_stack<max_depth> stack(deepest);
+    int current = 0;
+
+    while (true) {
+        const linear_bvh_node& node = nodes[current];
+
+        // slab test against the closest hit so far
+        double t0 = t_min, t1 = closest;
+        bool box_hit = true;
+        for (int a = 0; a < 3; a++) {
+            double t_near = (node.box_min[a] - origin[a]) * inv_dir[a];
+            double t_far  = (node.box_max[a] - origin[a]) * inv_dir[a];
+            if (dir_is_neg[a])
+                std::swap(t_near, t_far);
+            t0 = t_near > t0 ? t_near : t0;
+            t1 = t_far < t1 ? t_far : t1;
+            if (t1 <= t0) {
+                box_hit = false;
+                break;
+            }
+        }
+
+        if (box_hit) {
+            if (node.count > 0) {
+                for (int i = node.offset; i < node.offset + node.count; i++) {
+                    if constexpr (any_hit) {
+                        if (primitives[i]->occluded(r, t_min, closest))
+                            return true;
+                    } else if (primitives[i]->hit(r, t_min, closest, *rec)) {
+                        hit_anything = true;
+                        closest = rec->t;
+                    }
+                }
+            } else if (dir_is_neg[node.axis]) {
+                // going down the axis, the second child is the near one
+                stack.push(current + 1);
+                current = node.offset;
+                continue;
+            } else {
+                stack.push(node.offset);
+                current = current + 1;
+                continue;
+            }
+        }
+
+        if (stack.empty())
+            break;
+        current = stack.pop();
+    }
+
+    return hit_anything;
+}
+
+
+inline void linear_bvh::refit(double time0, double time1) {
+    if (nodes.empty())
+        return;
+
+    bvh_parallel_for(options, owned.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            owned[i]->refit(time0, time1);
+    });
+
+    // leaves in parallel, from their primitives
+    bvh_parallel_for(options, nodes.size(), [&](size_t begin, size_t end) {
+        for (size_t n = begin; n < end; n++) {
+            linear_bvh_node& node = nodes[n];
+            if (node.count == 0)
+                continue;
+
+            aabb box;
+            for (int i = node.offset; i < node.offset + node.count; i++) {
+                aabb b;
+                primitives[i]->bounding_box(time0, time1, b);
+                box = i == node.offset ? b : surrounding_box(box, b);
+            }
+            node.box_min = box.min();
+            node.box_max = box.max();
+        }
+    });
+
+    // then interior nodes bottom up, a subtree per task
+    auto children = [&](size_t n, auto f) {
+        if (nodes[n].count == 0) {
+            f(n + 1);
+            f(static_cast<size_t>(nodes[n].offset));
+        }
+    };
+    bvh_refit_interior(options, nodes.size(), children, [&](size_t n) {
+        linear_bvh_node& node = nodes[n];
+        if (node.count > 0)
+            return;
+
+        auto b = surrounding_box(aabb(nodes[n + 1].box_min, nodes[n + 1].box_max),
+                                 aabb(nodes[node.offset].box_min, nodes[node.offset].box_max));
+        node.box_min = b.min();
+        node.box_max = b.max();
+    });
+
+    double cost = sah_cost();
+    if (cost > built_cost * (1 + options.rebuild_threshold)) {
+        hittable_list list;
+        list.objects = owned;
+
+        bvh_options rebuild_options = options;
+        rebuild_options.report = false;
+        build(make_shared<bvh_node>(list, time0, time1, rebuild_options), time0, time1);
+
+        if (options.report)
+            std::cout << "refit SAH cost " << cost << " was past " << 1 + options.rebuild_threshold
+                      << "x the built tree's, rebuilt over " << list.objects.size()
+                      << " objects, SAH cost now " << built_cost << std::endl;
+    }
+}
+
+
+inline double linear_bvh::sah_cost() const {
+    if (nodes.empty())
+        return 0;
+
+    const double root_area = aabb(nodes[0].box_min, nodes[0].box_max).area();
+
+    double cost = 0;
+    for (const auto& node : nodes) {
+        double area = aabb(node.box_min, node.box_max).area();
+        double p = root_area > 0 ? area / root_area : 1;
+        cost += node.count == 0 ? options.traversal_cost * p
+                                : options.intersection_cost * p * node.count;
+    }
+
+    return cost;
+}
+
+
+inline bool linear_bvh::bounding_box(double t0, double t1, aabb& output_box) const {
+    if (nodes.empty())
+        return false;
+
+    output_box = aabb(nodes[0].box_min, nodes[0].box_max);
+    return true;
+}
+
+
+#endif
@@ -36,6 +36,8 @@ color ray_color(const ray& r, const color& background, const hittable& world, in
     if (!world.hit(r, 0.001, infinity, rec))
         return background;
 
+    evaluate_surface(r, rec);
+
     ray scattered;
     color attenuation;
     color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
@@ -33,6 +33,21 @@ class material  {
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const = 0;
+
+        // whether emitted() or scatter() read rec.u and rec.v
+        virtual bool uses_uv() const { return true; }
+
+        virtual bool is_emissive() const { return false; }
+
+        // Materials that scatter in proportion to the density they sample with (lambertian,
+        // isotropic) aren't specular - for those, the attenuation scatter() returns times
+        // scattering_pdf() is the BSDF times cosine for any direction, which is what direct
+        // light sampling needs. Specular ones (mirrors, glass) only get light by scattering.
+        virtual bool is_specular() const { return true; }
+
+        virtual double scattering_pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+            return 0;
+        }
 };
 
 
@@ -68,6 +83,8 @@ class dielectric : public material {
             return true;
         }
 
+        virtual bool uses_uv() const { return false; }
+
     public:
         double ref_idx;
 };
@@ -87,6 +104,10 @@ class diffuse_light : public material {
             return emit->value(u, v, p);
         }
 
+        virtual bool uses_uv() const { return emit->uses_uv(); }
+
+        virtual bool is_emissive() const { return true; }
+
     public:
         shared_ptr<texture> emit;
 };
@@ -104,6 +125,15 @@ class isotropic : public material {
             return true;
         }
 
+        virtual bool uses_uv() const { return albedo->uses_uv(); }
+
+        // scatters uniformly over the sphere of directions
+        virtual bool is_specular() const { return false; }
+
+        virtual double scattering_pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+            return 1 / (4*pi);
+        }
+
     public:
         shared_ptr<texture> albedo;
 };
@@ -122,6 +152,16 @@ class lambertian : public material {
             return true;
         }
 
+        virtual bool uses_uv() const { return albedo->uses_uv(); }
+
+        // normal + random_unit_vector() is cosine distributed about the normal
+        virtual bool is_specular() const { return false; }
+
+        virtual double scattering_pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+            auto cosine = dot(rec.normal, unit_vector(direction));
+            return cosine < 0 ? 0 : cosine/pi;
+        }
+
     public:
         shared_ptr<texture> albedo;
 };
@@ -140,6 +180,8 @@ class metal : public material {
             return (dot(scattered.direction(), rec.normal) > 0);
         }
 
+        virtual bool uses_uv() const { return false; }
+
     public:
         color albedo;
         double fuzz;
@@ -14,6 +14,8 @@
 #include "rtweekend.h"
 
 #include "hittable.h"
+#include "material.h"
+#include "sphere.h"
 
 
 class moving_sphere : public hittable {
@@ -25,7 +27,9 @@ class moving_sphere : public hittable {
         {};
 
         virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const;
         virtual bool bounding_box(double t0, double t1, aabb& output_box) const;
+        virtual void get_surface(const ray& r, hit_record& rec) const;
 
         point3 center(double time) const;
 
@@ -56,38 +60,25 @@ inline bool moving_sphere::bounding_box(double t0, double t1, aabb& output_box)
 
 // replace "center" with "center(r.time())"
 inline bool moving_sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    vec3 oc = r.origin() - center(r.time());
-    auto a = r.direction().length_squared();
-    auto half_b = dot(oc, r.direction());
-    auto c = oc.length_squared() - radius*radius;
-
-    auto discriminant = half_b*half_b - a*c;
-
-    if (discriminant > 0) {
-        auto root = sqrt(discriminant);
-
-        auto temp = (-half_b - root)/a;
-        if (temp < t_max && temp > t_min) {
-            rec.t = temp;
-            rec.p = r.at(rec.t);
-            vec3 outward_normal = (rec.p - center(r.time())) / radius;
-            rec.set_face_normal(r, outward_normal);
-            rec.mat_ptr = mat_ptr;
-            return true;
-        }
-
-        temp = (-half_b + root)/a;
-        if (temp < t_max && temp > t_min) {
-            rec.t = temp;
-            rec.p = r.at(rec.t);
-            vec3 outward_normal = (rec.p - center(r.time())) / radius;
-            rec.set_face_normal(r, outward_normal);
-            rec.mat_ptr = mat_ptr;
-            return true;
-        }
-    }
-
-    return false;
+    if (!sphere_intersect(center(r.time()), radius, r, t_min, t_max, rec.t))
+        return false;
+
+    rec.mat_ptr = mat_ptr.get();
+    rec.prim = this;
+    return true;
+}
+
+inline bool moving_sphere::occluded(const ray& r, double t_min, double t_max) const {
+    double t;
+    return sphere_intersect(center(r.time()), radius, r, t_min, t_max, t);
+}
+
+inline void moving_sphere::get_surface(const ray& r, hit_record& rec) const {
+    rec.p = r.at(rec.t);
+    vec3 outward_normal = (rec.p - center(r.time())) / radius;
+    rec.set_face_normal(r, outward_normal);
+    if (rec.mat_ptr->uses_uv())
+        get_sphere_uv(outward_normal, rec.u, rec.v);
 }
 
 #endif
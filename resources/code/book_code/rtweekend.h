@@ -10,11 +10,14 @@
 //==============================================================================================
 
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <limits>
 #include <memory>
 #include <random>
 
+#include "sampler.h"
+
 // Usings
 
 using std::shared_ptr;
@@ -38,13 +41,61 @@ inline double clamp(double x, double min, double max) {
     return x;
 }
 
+// Random Number Generation
+//
+// Every thread owns a PCG32 generator (see pcg-random.org), so there is no shared state or lock
+// on the hot path. The renderer reseeds it from the pixel and sample index before tracing each
+// path, which makes the image independent of which thread traced which pixel.
+
+class pcg32 {
+    public:
+        pcg32() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+
+        void seed(uint64_t initstate, uint64_t initseq) {
+            state = 0u;
+            inc = (initseq << 1u) | 1u;
+            next();
+            state += initstate;
+            next();
+        }
+
+        uint32_t next() {
+            uint64_t oldstate = state;
+            state = oldstate * 6364136223846793005ULL + inc;
+            uint32_t xorshifted = static_cast<uint32_t>(((oldstate >> 18u) ^ oldstate) >> 27u);
+            uint32_t rot = static_cast<uint32_t>(oldstate >> 59u);
+            return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+        }
+
+    private:
+        uint64_t state;
+        uint64_t inc;
+};
+
+inline pcg32& thread_rng() {
+    thread_local pcg32 rng;
+    return rng;
+}
+
+inline uint64_t hash_combine(uint64_t a, uint64_t b) {
+    // splitmix64 finalizer over the pair
+    uint64_t z = a * 0x9e3779b97f4a7c15ULL + b + 0x632be59bd9b4e019ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+inline void seed_random(uint64_t pixel_index, uint64_t sample_index) {
+    // Key the calling thread's generator on (pixel, sample) - one independent stream per path.
+    thread_rng().seed(hash_combine(pixel_index, sample_index), hash_combine(sample_index, pixel_index));
+}
+
 inline double random_double() {
-    return rand() / (RAND_MAX + 1.0);
-    
-    // static std::random_device rd;  //Will be used to obtain a seed for the random number engine
-    // static std::mt19937 gen(rd()); //Standard mersenne_twister_engine seeded with rd()
-    // std::uniform_real_distribution<> dis(0.0, 1.0);
-    // return dis(gen);
+    // Returns a random real in [0,1) - from the thread's sampler, while it's running.
+    sampler& s = thread_sampler();
+    if (s.active())
+        return s.next();
+    return thread_rng().next() * (1.0 / 4294967296.0);
 }
 
 inline double random_double(double min, double max) {
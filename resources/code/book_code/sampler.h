@@ -0,0 +1,156 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include <cstdint>
+
+
+// Low discrepancy sample values for the renderer's random decisions.
+//
+// While a sampler is running on a thread, random_double() draws from it instead of the
+// thread's PCG stream. Each call takes the next dimension of the current sample - the integrator
+// moves to a fresh block of dimensions for the camera and for every bounce, so a given decision
+// (lens position, shutter time, the first bounce's scatter direction, ...) lands on the same
+// dimensions for every sample of a pixel, and is stratified across the pixel's samples. Calls
+// past the end of a block fall back to the PCG stream rather than reuse a dimension.
+//
+// Dimensions are padded 2D Sobol: each pair of dimensions is the first two Sobol dimensions,
+// with the sample index shuffled and the values Owen scrambled, using hashes seeded by the
+// pixel and the pair. Scrambled points are individually uniform, so the result is unbiased
+// whatever order a path happens to consume them in.
+
+enum class sampler_type {
+    random,     // white noise from the PCG stream, as before
+    sobol,      // Owen scrambled Sobol, decorrelated per pixel by its scrambling seed
+    dither      // one Owen scrambled Sobol set shared by every pixel, toroidally shifted per pixel
+                // by an R2 dither pattern - error comes out as blue noise across the screen
+};
+
+
+inline uint32_t reverse_bits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// Hash based nested uniform scrambling (Owen scrambling) of a 32 bit fraction - the hash only
+// lets lower bits depend on higher ones, which is done on the reversed bits.
+inline uint32_t owen_scramble(uint32_t x, uint32_t seed) {
+    x = reverse_bits(x);
+    x ^= x * 0x3d20adeau;
+    x += seed;
+    x *= (seed >> 16) | 1;
+    x ^= x * 0x05526c56u;
+    x ^= x * 0x53a22864u;
+    return reverse_bits(x);
+}
+
+inline uint32_t hash_u32(uint32_t a, uint32_t b) {
+    uint64_t z = (static_cast<uint64_t>(a) << 32 | b) * 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return static_cast<uint32_t>(z ^ (z >> 31));
+}
+
+// First two Sobol dimensions - the first is the van der Corput sequence, the second comes from
+// the primitive polynomial x + 1.
+inline uint32_t sobol_0(uint32_t index) {
+    return reverse_bits(index);
+}
+
+inline uint32_t sobol_1(uint32_t index) {
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+        if (index & 1)
+            result ^= v;
+    return result;
+}
+
+
+class sampler {
+    public:
+        static const int camera_dimensions = 8;     // pixel position, lens, shutter time
+        static const int bounce_dimensions = 16;    // scatter, light choice and position, roulette, media
+
+        void start(sampler_type t, int x, int y, uint32_t sample) {
+            type = t;
+            sample_index = sample;
+            pixel_seed = (type == sampler_type::dither) ? 0x2545f491u
+                                                        : hash_u32(static_cast<uint32_t>(x), static_cast<uint32_t>(y));
+
+            // R2 sequence over the pixel grid, used as the per pixel shift for the dithered set
+            dither = x * 0.7548776662466927 + y * 0.5698402909980532;
+            dither -= static_cast<long>(dither);
+
+            dimension_block(0, camera_dimensions);
+        }
+
+        // moves on to the dimensions for bounce n
+        void start_bounce(int n) { dimension_block(camera_dimensions + n * bounce_dimensions, bounce_dimensions); }
+
+        bool active() const { return type != sampler_type::random && dimension < block_end; }
+
+        // next dimension of the current sample, in [0,1)
+        double next() {
+            int d = dimension++;
+            if (d & 1)
+                return second;
+
+            // both values of the pair at once - the odd one is kept for the next call
+            uint32_t pair_seed = hash_u32(pixel_seed, static_cast<uint32_t>(d));
+            uint32_t index = owen_scramble(sample_index, pair_seed);
+            uint32_t a = owen_scramble(sobol_0(index), hash_u32(pair_seed, 0));
+            uint32_t b = owen_scramble(sobol_1(index), hash_u32(pair_seed, 1));
+
+            double u = a * (1.0 / 4294967296.0);
+            second = b * (1.0 / 4294967296.0);
+
+            if (type == sampler_type::dither) {
+                // golden ratio steps, so each dimension gets a different shift of the pattern
+                u = shift(u, dither + d * 0.6180339887498949);
+                second = shift(second, dither + (d + 1) * 0.6180339887498949);
+            }
+
+            return u;
+        }
+
+        void stop() { type = sampler_type::random; }
+
+    private:
+        void dimension_block(int first, int count) {
+            dimension = first;
+            block_end = first + count;
+        }
+
+        static double shift(double u, double offset) {
+            u += offset - static_cast<long>(offset);
+            return u >= 1.0 ? u - 1.0 : u;
+        }
+
+        sampler_type type = sampler_type::random;
+        uint32_t sample_index = 0;
+        uint32_t pixel_seed = 0;
+        double dither = 0;
+
+        int dimension = 0;
+        int block_end = 0;
+        double second = 0;
+};
+
+inline sampler& thread_sampler() {
+    thread_local sampler s;
+    return s;
+}
+
+
+#endif
@@ -14,6 +14,7 @@
 #include "rtweekend.h"
 
 #include "hittable.h"
+#include "material.h"
 
 
 class sphere: public hittable  {
@@ -22,7 +23,17 @@ class sphere: public hittable  {
         sphere(point3 cen, double r, shared_ptr<material> m)
             : center(cen), radius(r), mat_ptr(m) {};
         virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const;
         virtual bool bounding_box(double t0, double t1, aabb& output_box) const;
+        virtual void get_surface(const ray& r, hit_record& rec) const;
+
+        virtual double pdf_value(const point3& o, const vec3& v) const;
+        virtual vec3 random(const point3& o) const;
+
+        virtual void collect_lights(std::vector<const hittable*>& lights) const {
+            if (mat_ptr->is_emissive())
+                lights.push_back(this);
+        }
 
     public:
         point3 center;
@@ -38,7 +49,10 @@ inline bool sphere::bounding_box(double t0, double t1, aabb& output_box) const {
     return true;
 }
 
-inline bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+// nearer of the two intersections inside (t_min, t_max), if either is
+inline bool sphere_intersect(
+    const point3& center, double radius, const ray& r, double t_min, double t_max, double& t
+) {
     vec3 oc = r.origin() - center;
     auto a = r.direction().length_squared();
     auto half_b = dot(oc, r.direction());
@@ -51,23 +65,13 @@ inline bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& re
 
         auto temp = (-half_b - root)/a;
         if (temp < t_max && temp > t_min) {
-            rec.t = temp;
-            rec.p = r.at(rec.t);
-            vec3 outward_normal = (rec.p - center) / radius;
-            rec.set_face_normal(r, outward_normal);
-            get_sphere_uv((rec.p-center)/radius, rec.u, rec.v);
-            rec.mat_ptr = mat_ptr;
+            t = temp;
             return true;
         }
 
         temp = (-half_b + root)/a;
         if (temp < t_max && temp > t_min) {
-            rec.t = temp;
-            rec.p = r.at(rec.t);
-            vec3 outward_normal = (rec.p - center) / radius;
-            rec.set_face_normal(r, outward_normal);
-            get_sphere_uv((rec.p-center)/radius, rec.u, rec.v);
-            rec.mat_ptr = mat_ptr;
+            t = temp;
             return true;
         }
     }
@@ -75,4 +79,71 @@ inline bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& re
     return false;
 }
 
+inline bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    if (!sphere_intersect(center, radius, r, t_min, t_max, rec.t))
+        return false;
+
+    rec.mat_ptr = mat_ptr.get();
+    rec.prim = this;
+    return true;
+}
+
+inline bool sphere::occluded(const ray& r, double t_min, double t_max) const {
+    double t;
+    return sphere_intersect(center, radius, r, t_min, t_max, t);
+}
+
+inline void sphere::get_surface(const ray& r, hit_record& rec) const {
+    rec.p = r.at(rec.t);
+    vec3 outward_normal = (rec.p - center) / radius;
+    rec.set_face_normal(r, outward_normal);
+    if (rec.mat_ptr->uses_uv())
+        get_sphere_uv(outward_normal, rec.u, rec.v);
+}
+
+// Direction inside the cone a sphere of the given radius subtends, seen from a distance - uniform
+// over the cone's solid angle, about +z.
+inline vec3 random_to_sphere(double radius, double distance_squared) {
+    auto r1 = random_double();
+    auto r2 = random_double();
+    auto z = 1 + r2*(sqrt(1-radius*radius/distance_squared) - 1);
+
+    auto phi = 2*pi*r1;
+    auto x = cos(phi)*sqrt(1-z*z);
+    auto y = sin(phi)*sqrt(1-z*z);
+
+    return vec3(x, y, z);
+}
+
+inline double sphere::pdf_value(const point3& o, const vec3& v) const {
+    auto distance_squared = (center - o).length_squared();
+    if (distance_squared <= radius*radius)
+        return 0;   // from inside there's no cone to sample
+
+    hit_record rec;
+    if (!this->hit(ray(o, v), 0.001, infinity, rec))
+        return 0;
+
+    auto cos_theta_max = sqrt(1 - radius*radius/distance_squared);
+    auto solid_angle = 2*pi*(1-cos_theta_max);
+
+    return 1 / solid_angle;
+}
+
+inline vec3 sphere::random(const point3& o) const {
+    vec3 direction = center - o;
+    auto distance_squared = direction.length_squared();
+    if (distance_squared <= radius*radius)
+        return vec3(0,0,0);
+
+    // orthonormal basis around the direction to the center
+    vec3 w = unit_vector(direction);
+    vec3 a = (fabs(w.x()) > 0.9) ? vec3(0,1,0) : vec3(1,0,0);
+    vec3 v = unit_vector(cross(w, a));
+    vec3 u = cross(w, v);
+
+    vec3 d = random_to_sphere(radius, distance_squared);
+    return d.x()*u + d.y()*v + d.z()*w;
+}
+
 #endif
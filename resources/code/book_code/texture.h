@@ -14,13 +14,16 @@
 #include "rtweekend.h"
 
 #include "perlin.h"
-#include "../includes.h"
+#include "../lodepng.h"
 #include <iostream>
 
 
 class texture  {
     public:
         virtual color value(double u, double v, const vec3& p) const = 0;
+
+        // whether value() looks at u and v - if not, hits don't have to work them out
+        virtual bool uses_uv() const { return true; }
 };
 
 
@@ -36,6 +39,8 @@ class solid_color : public texture {
             return color_value;
         }
 
+        virtual bool uses_uv() const { return false; }
+
     private:
         color color_value;
 };
@@ -54,6 +59,8 @@ class checker_texture : public texture {
                 return even->value(u, v, p);
         }
 
+        virtual bool uses_uv() const { return even->uses_uv() || odd->uses_uv(); }
+
     public:
 		shared_ptr<texture> even;
         shared_ptr<texture> odd;
@@ -71,6 +78,8 @@ class noise_texture : public texture {
             return color(1,1,1)*0.5*(1 + sin(scale*p.z() + 10*noise.turb(p)));
         }
 
+        virtual bool uses_uv() const { return false; }
+
     public:
         perlin noise;
         double scale;
@@ -0,0 +1,144 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+
+
+// An affine transform - a 3x3 linear part m, then a translation t. Composes right to left,
+// so (a * b) applies b first.
+
+class affine {
+    public:
+        affine() : m{{1,0,0}, {0,1,0}, {0,0,1}}, t(0,0,0) {}
+
+        static affine translation(const vec3& offset) {
+            affine a;
+            a.t = offset;
+            return a;
+        }
+
+        static affine scaling(const vec3& s) {
+            affine a;
+            for (int i = 0; i < 3; i++)
+                a.m[i][i] = s[i];
+            return a;
+        }
+
+        // right handed rotation about any axis (Rodrigues' formula)
+        static affine rotation(const vec3& axis, double degrees) {
+            auto k = unit_vector(axis);
+            auto radians = degrees_to_radians(degrees);
+            auto c = cos(radians);
+            auto s = sin(radians);
+            auto C = 1 - c;
+
+            affine a;
+            a.m[0][0] = c + k.x()*k.x()*C;
+            a.m[0][1] = k.x()*k.y()*C - k.z()*s;
+            a.m[0][2] = k.x()*k.z()*C + k.y()*s;
+            a.m[1][0] = k.y()*k.x()*C + k.z()*s;
+            a.m[1][1] = c + k.y()*k.y()*C;
+            a.m[1][2] = k.y()*k.z()*C - k.x()*s;
+            a.m[2][0] = k.z()*k.x()*C - k.y()*s;
+            a.m[2][1] = k.z()*k.y()*C + k.x()*s;
+            a.m[2][2] = c + k.z()*k.z()*C;
+            return a;
+        }
+
+        static affine rotation_x(double degrees) { return rotation(vec3(1,0,0), degrees); }
+        static affine rotation_y(double degrees) { return rotation(vec3(0,1,0), degrees); }
+        static affine rotation_z(double degrees) { return rotation(vec3(0,0,1), degrees); }
+
+        vec3 vector(const vec3& v) const {
+            return vec3(m[0][0]*v[0] + m[0][1]*v[1] + m[0][2]*v[2],
+                        m[1][0]*v[0] + m[1][1]*v[1] + m[1][2]*v[2],
+                        m[2][0]*v[0] + m[2][1]*v[1] + m[2][2]*v[2]);
+        }
+
+        point3 point(const point3& p) const { return vector(p) + t; }
+
+        // multiplies by the transpose of m - normals go through the inverse's transpose
+        vec3 transpose_vector(const vec3& v) const {
+            return vec3(m[0][0]*v[0] + m[1][0]*v[1] + m[2][0]*v[2],
+                        m[0][1]*v[0] + m[1][1]*v[1] + m[2][1]*v[2],
+                        m[0][2]*v[0] + m[1][2]*v[1] + m[2][2]*v[2]);
+        }
+
+        affine operator*(const affine& b) const {
+            affine a;
+            for (int i = 0; i < 3; i++)
+                for (int j = 0; j < 3; j++)
+                    a.m[i][j] = m[i][0]*b.m[0][j] + m[i][1]*b.m[1][j] + m[i][2]*b.m[2][j];
+            a.t = point(b.t);
+            return a;
+        }
+
+        affine inverse() const {
+            // adjugate over the determinant
+            double cof[3][3];
+            for (int i = 0; i < 3; i++)
+                for (int j = 0; j < 3; j++)
+                    cof[i][j] = m[(i+1)%3][(j+1)%3] * m[(i+2)%3][(j+2)%3]
+                              - m[(i+1)%3][(j+2)%3] * m[(i+2)%3][(j+1)%3];
+
+            double det = m[0][0]*cof[0][0] + m[0][1]*cof[0][1] + m[0][2]*cof[0][2];
+            if (det == 0)
+                std::cerr << "Inverting a singular transform.\n";
+
+            affine a;
+            for (int i = 0; i < 3; i++)
+                for (int j = 0; j < 3; j++)
+                    a.m[i][j] = cof[j][i] / det;
+            a.t = -a.vector(t);
+            return a;
+        }
+
+        // a rotation and a uniform scale at most - angles, and so solid angles, survive it
+        bool is_similarity() const {
+            vec3 c[3];
+            for (int j = 0; j < 3; j++)
+                c[j] = vec3(m[0][j], m[1][j], m[2][j]);
+
+            auto scale = c[0].length_squared();
+            auto close = [scale](double a, double b) { return fabs(a - b) <= 1e-9 * scale; };
+
+            return close(c[1].length_squared(), scale) && close(c[2].length_squared(), scale)
+                && close(dot(c[0], c[1]), 0) && close(dot(c[1], c[2]), 0) && close(dot(c[0], c[2]), 0);
+        }
+
+        // box around the transformed corners
+        aabb box(const aabb& b) const {
+            point3 min( infinity,  infinity,  infinity);
+            point3 max(-infinity, -infinity, -infinity);
+
+            for (int i = 0; i < 8; i++) {
+                point3 corner(i & 1 ? b.max().x() : b.min().x(),
+                              i & 2 ? b.max().y() : b.min().y(),
+                              i & 4 ? b.max().z() : b.min().z());
+                point3 p = point(corner);
+                for (int c = 0; c < 3; c++) {
+                    min[c] = fmin(min[c], p[c]);
+                    max[c] = fmax(max[c], p[c]);
+                }
+            }
+
+            return aabb(min, max);
+        }
+
+    public:
+        double m[3][3];
+        vec3 t;
+};
+
+
+#endif
@@ -139,12 +139,13 @@ inline vec3 unit_vector(vec3 v) {
     return v / v.length();
 }
 
+// These map a fixed number of random values straight to the shape, rather than rejection
+// sampling, so a low discrepancy sampler's dimensions line up from one sample to the next.
+
 inline vec3 random_in_unit_disk() {
-    while (true) {
-        auto p = vec3(random_double(-1,1), random_double(-1,1), 0);
-        if (p.length_squared() >= 1) continue;
-        return p;
-    }
+    auto r = sqrt(random_double());
+    auto a = random_double(0, 2*pi);
+    return vec3(r*cos(a), r*sin(a), 0);
 }
 
 inline vec3 random_unit_vector() {
@@ -155,11 +156,7 @@ inline vec3 random_unit_vector() {
 }
 
 inline vec3 random_in_unit_sphere() {
-    while (true) {
-        auto p = vec3::random(-1,1);
-        if (p.length_squared() >= 1) continue;
-        return p;
-    }
+    return random_unit_vector() * cbrt(random_double());
 }
 
 inline vec3 random_in_hemisphere(const vec3& normal) {
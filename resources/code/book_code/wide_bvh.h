@@ -0,0 +1,547 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable_list.h"
+
+#include <cfloat>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define WIDE_BVH_SSE
+#endif
+
+
+// A 4-wide BVH - the binary tree collapsed so every node has up to four children, whose boxes
+// are stored structure-of-arrays in single precision. One slab test against a precomputed
+// reciprocal direction checks all four children at once (an SSE register per bound, per axis).
+//
+// Boxes are rounded outward when converted to float, so they can only grow. Unused child slots
+// get an inverted box that no ray can hit.
+//
+// With anything moving in the tree, every node also keeps how its children's boxes change from
+// time0 to time1, and the slab test uses the boxes interpolated to the ray's time - a box at
+// either end bounds its children at that end, and for things moving in a straight line the
+// interpolated boxes bound them in between too. Rays then see boxes about the size of the
+// objects at their instant, instead of around the whole sweep.
+//
+// After an animation frame, refit() recomputes every box in place over the same tree - leaf
+// lanes in parallel, then interior lanes bottom up, a subtree at a time in parallel too - and
+// only rebuilds from scratch once the
+// tree's SAH cost has grown past the options' rebuild_threshold.
+
+struct alignas(16) wide_bvh_node {
+    float bounds[6][4];     // min x, y, z then max x, y, z - one lane per child, at time0
+    int child[4];           // node index (interior) or first primitive (leaf)
+    int count[4];           // primitives in a leaf child, 0 for interior, -1 for an empty slot
+};
+
+// change in each bound from time0 to time1, rounded outward too - parallel to the nodes
+struct alignas(16) wide_bvh_motion {
+    float delta[6][4];
+};
+
+
+class wide_bvh : public hittable {
+    public:
+        wide_bvh() {}
+
+        // builds a bvh_node tree with the given options, then collapses it
+        wide_bvh(hittable_list& list, double time0, double time1,
+                 const bvh_options& options = bvh_options());
+
+        wide_bvh(const shared_ptr<hittable>& tree, double time0, double time1,
+                 const bvh_options& options = bvh_options());
+
+        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+            return motion.empty() ? traverse<false, false>(r, t_min, t_max, &rec)
+                                  : traverse<false, true>(r, t_min, t_max, &rec);
+        }
+
+        virtual bool occluded(const ray& r, double t_min, double t_max) const {
+            return motion.empty() ? traverse<true, false>(r, t_min, t_max, nullptr)
+                                  : traverse<true, true>(r, t_min, t_max, nullptr);
+        }
+
+        virtual bool bounding_box(double t0, double t1, aabb& output_box) const;
+
+        virtual void collect_lights(std::vector<const hittable*>& lights) const {
+            for (auto p : primitives)
+                p->collect_lights(lights);
+        }
+
+        virtual void refit(double time0, double time1);
+
+        size_t node_count() const { return nodes.size(); }
+
+        // SAH cost over the lane boxes, swept over the shutter interval - relative to the root box
+        double sah_cost() const;
+
+    public:
+        static const int width = 4;
+        static const int max_depth = 64;   // traversal stack kept on the C++ stack, deeper trees spill
+
+        std::vector<wide_bvh_node> nodes;
+        std::vector<wide_bvh_motion> motion;    // empty when nothing moves
+        std::vector<const hittable*> primitives;
+        aabb root_box;
+
+    private:
+        // closest hit into rec - or with any_hit, returns at the first hit found and rec is unused.
+        // with moving, node boxes are interpolated to the ray's time
+        template <bool any_hit, bool moving>
+        bool traverse(const ray& r, double t_min, double t_max, hit_record* rec) const;
+
+        void build(const shared_ptr<hittable>& tree, double time0, double time1);
+        void drop_static_motion();
+
+        // returns the node's index, and the boxes around everything under it at time0 and time1
+        int collapse(const shared_ptr<hittable>& h, double time0, double time1, int depth,
+                     aabb& box0, aabb& box1);
+        void add_primitives(const shared_ptr<hittable>& h);
+        void set_lane(int index, int lane, const aabb& box0, const aabb& box1);
+        void leaf_boxes(int first, int count, double time0, double time1, aabb& box0, aabb& box1) const;
+
+        double shutter_open = 0;
+        double inv_shutter = 0;     // 1 / (time1 - time0), zero without motion
+
+        std::vector<shared_ptr<hittable>> owned;   // keeps the primitives alive
+        int deepest = 0;
+
+        bvh_options options;        // for refitting in parallel, and rebuilding
+        double built_cost = 0;      // SAH cost as last built
+        friend class bvh_cache;     // saves and restores all of the above
+};
+
+
+inline bool is_interior(const shared_ptr<hittable>& h) {
+    auto node = std::dynamic_pointer_cast<bvh_node>(h);
+    return node && node->left != node->right;
+}
+
+
+// Children of a node in a tree collapsed to the given width - the children of the largest
+// interior child are pulled up in its place until there are enough, or nothing left to open.
+inline std::vector<shared_ptr<hittable>> wide_children(
+    const shared_ptr<hittable>& h, double time0, double time1, size_t width
+) {
+    std::vector<shared_ptr<hittable>> children;
+    if (is_interior(h)) {
+        auto node = std::static_pointer_cast<bvh_node>(h);
+        children = { node->left, node->right };
+    } else {
+        children = { h };
+    }
+
+    while (children.size() < width) {
+        int largest = -1;
+        double largest_area = -1;
+        for (size_t i = 0; i < children.size(); i++) {
+            aabb b;
+            if (is_interior(children[i]) && children[i]->bounding_box(time0, time1, b)
+                && b.area() > largest_area) {
+                largest = static_cast<int>(i);
+                largest_area = b.area();
+            }
+        }
+        if (largest < 0)
+            break;
+
+        auto node = std::static_pointer_cast<bvh_node>(children[largest]);
+        children[largest] = node->left;
+        children.push_back(node->right);
+    }
+
+    return children;
+}
+
+
+inline wide_bvh::wide_bvh(
+    hittable_list& list, double time0, double time1, const bvh_options& options
+) : wide_bvh(make_shared<bvh_node>(list, time0, time1, options), time0, time1, options) {
+    if (options.report)
+        std::cout << "collapsed to " << nodes.size() << " " << width << "-wide nodes ("
+                  << (nodes.size() * sizeof(wide_bvh_node) + motion.size() * sizeof(wide_bvh_motion)) / 1024
+                  << "KB" << (motion.empty() ? "" : ", with motion bounds") << "), depth "
+                  << deepest << std::endl;
+}
+
+
+inline wide_bvh::wide_bvh(
+    const shared_ptr<hittable>& tree, double time0, double time1, const bvh_options& options
+) : options(options) {
+    build(tree, time0, time1);
+}
+
+
+inline void wide_bvh::build(const shared_ptr<hittable>& tree, double time0, double time1) {
+    nodes.clear();
+    motion.clear();
+    primitives.clear();
+    owned.clear();
+    deepest = 0;
+
+    if (!tree->bounding_box(time0, time1, root_box))
+        std::cerr << "No bounding box in wide_bvh constructor.\n";
+
+    shutter_open = time0;
+    inv_shutter = time1 > time0 ? 1.0 / (time1 - time0) : 0;
+
+    aabb box0, box1;
+    collapse(tree, time0, time1, 1, box0, box1);
+    drop_static_motion();
+    built_cost = sah_cost();
+}
+
+
+// no point interpolating boxes that never change
+inline void wide_bvh::drop_static_motion() {
+    bool moves = false;
+    for (const auto& m : motion)
+        for (int a = 0; a < 6; a++)
+            for (int i = 0; i < width; i++)
+                moves |= m.delta[a][i] != 0;
+    if (!moves || inv_shutter == 0)
+        motion.clear();
+}
+
+
+inline void wide_bvh::add_primitives(const shared_ptr<hittable>& h) {
+    if (auto list = std::dynamic_pointer_cast<hittable_list>(h)) {
+        for (const auto& object : list->objects)
+            add_primitives(object);
+    } else {
+        owned.push_back(h);
+        primitives.push_back(h.get());
+    }
+}
+
+
+// Stores a child's boxes at time0 and time1 in one lane of a node.
+inline void wide_bvh::set_lane(int index, int lane, const aabb& box0, const aabb& box1) {
+    wide_bvh_node& n = nodes[index];
+    wide_bvh_motion& m = motion[index];
+
+    for (int a = 0; a < 3; a++) {
+        n.bounds[a][lane] = std::nextafter(static_cast<float>(box0.min()[a]), -FLT_MAX);
+        n.bounds[a + 3][lane] = std::nextafter(static_cast<float>(box0.max()[a]), FLT_MAX);
+
+        float end_min = std::nextafter(static_cast<float>(box1.min()[a]), -FLT_MAX);
+        float end_max = std::nextafter(static_cast<float>(box1.max()[a]), FLT_MAX);
+
+        float d_min = end_min - n.bounds[a][lane];
+        float d_max = end_max - n.bounds[a + 3][lane];
+        m.delta[a][lane] = d_min == 0 ? 0 : std::nextafter(d_min, -FLT_MAX);
+        m.delta[a + 3][lane] = d_max == 0 ? 0 : std::nextafter(d_max, FLT_MAX);
+    }
+}
+
+
+// Boxes around a leaf's primitives at time0 and at time1.
+inline void wide_bvh::leaf_boxes(
+    int first, int count, double time0, double time1, aabb& box0, aabb& box1
+) const {
+    for (int p = first; p < first + count; p++) {
+        aabb b0, b1;
+        primitives[p]->bounding_box(time0, time0, b0);
+        primitives[p]->bounding_box(time1, time1, b1);
+        box0 = p == first ? b0 : surrounding_box(box0, b0);
+        box1 = p == first ? b1 : surrounding_box(box1, b1);
+    }
+}
+
+
+// Pulls the children of the largest interior child up into this node until it has four,
+// then lays the node out and recurses into whichever children are still interior.
+inline int wide_bvh::collapse(
+    const shared_ptr<hittable>& h, double time0, double time1, int depth, aabb& box0, aabb& box1
+) {
+    deepest = std::max(deepest, depth);
+
+    auto children = wide_children(h, time0, time1, width);
+
+    int index = static_cast<int>(nodes.size());
+    nodes.emplace_back();
+    motion.emplace_back();
+
+    for (int i = 0; i < width; i++) {
+        if (i >= static_cast<int>(children.size())) {
+            for (int a = 0; a < 3; a++) {
+                nodes[index].bounds[a][i] = FLT_MAX;
+                nodes[index].bounds[a + 3][i] = -FLT_MAX;
+                motion[index].delta[a][i] = 0;
+                motion[index].delta[a + 3][i] = 0;
+            }
+            nodes[index].child[i] = 0;
+            nodes[index].count[i] = -1;
+            continue;
+        }
+
+        // boxes of the child at either end of the shutter interval - the arrays can be
+        // reallocated under the recursion, so nodes[index] is looked up fresh each time
+        aabb child0, child1;
+
+        if (is_interior(children[i])) {
+            int c = collapse(children[i], time0, time1, depth + 1, child0, child1);
+            nodes[index].child[i] = c;
+            nodes[index].count[i] = 0;
+        } else {
+            auto leaf = std::dynamic_pointer_cast<bvh_node>(children[i]);
+            int first = static_cast<int>(primitives.size());
+            add_primitives(leaf ? leaf->left : children[i]);
+            int count = static_cast<int>(primitives.size()) - first;
+            leaf_boxes(first, count, time0, time1, child0, child1);
+
+            nodes[index].child[i] = first;
+            nodes[index].count[i] = count;
+        }
+
+        set_lane(index, i, child0, child1);
+        box0 = i == 0 ? child0 : surrounding_box(box0, child0);
+        box1 = i == 0 ? child1 : surrounding_box(box1, child1);
+    }
+
+    return index;
+}
+
+
+template <bool any_hit, bool moving>
+inline bool wide_bvh::traverse(const ray& r, double t_min, double t_max, hit_record* rec) const {
+    if (nodes.empty())
+        return false;
+
+    const float origin[3] = {
+        static_cast<float>(r.origin().x()), static_cast<float>(r.origin().y()), static_cast<float>(r.origin().z())
+    };
+    const float inv_dir[3] = {
+        static_cast<float>(1.0 / r.direction().x()),
+        static_cast<float>(1.0 / r.direction().y()),
+        static_cast<float>(1.0 / r.direction().z())
+    };
+
+    // rows of wide_bvh_node::bounds holding each axis' near and far planes for this ray
+    int near_row[3], far_row[3];
+    for (int a = 0; a < 3; a++) {
+        near_row[a] = inv_dir[a] < 0 ? a + 3 : a;
+        far_row[a]  = inv_dir[a] < 0 ? a : a + 3;
+    }
+
+    // how far through the shutter interval the ray is, for interpolating boxes
+    const float s = moving ? static_cast<float>((r.time() - shutter_open) * inv_shutter) : 0.0f;
+
+    bool hit_anything = false;
+    double closest = t_max;
+
+    bvh_stack<max_depth * (width - 1) + 1> stack(deepest * (width - 1) + 1);
+    stack.push(0);
+
+#ifdef WIDE_BVH_SSE
+    const __m128 o[3]   = { _mm_set1_ps(origin[0]), _mm_set1_ps(origin[1]), _mm_set1_ps(origin[2]) };
+    const __m128 inv[3] = { _mm_set1_ps(inv_dir[0]), _mm_set1_ps(inv_dir[1]), _mm_set1_ps(inv_dir[2]) };
+    const __m128 t_lo   = _mm_set1_ps(static_cast<float>(t_min));
+    const __m128 s4     = _mm_set1_ps(s);
+#endif
+
+    while (!stack.empty()) {
+        const int index = stack.pop();
+        const wide_bvh_node& node = nodes[index];
+
+        // a little slack on the far end, for the rounding in the float slab test
+        const float t_hi = static_cast<float>(closest) * 1.0001f;
+
+        float t_enter[width];
+        int mask = 0;
+
+#ifdef WIDE_BVH_SSE
+        // max/min take the second operand when the first is NaN (0 * inf in a slab the
+        // ray is parallel to), so the running value goes second to ignore those lanes
+        __m128 t0 = t_lo;
+        __m128 t1 = _mm_set1_ps(t_hi);
+        for (int a = 0; a < 3; a++) {
+            __m128 b_near = _mm_load_ps(node.bounds[near_row[a]]);
+            __m128 b_far  = _mm_load_ps(node.bounds[far_row[a]]);
+            if constexpr (moving) {
+                const wide_bvh_motion& m = motion[index];
+                b_near = _mm_add_ps(b_near, _mm_mul_ps(_mm_load_ps(m.delta[near_row[a]]), s4));
+                b_far  = _mm_add_ps(b_far,  _mm_mul_ps(_mm_load_ps(m.delta[far_row[a]]), s4));
+            }
+            __m128 t_near = _mm_mul_ps(_mm_sub_ps(b_near, o[a]), inv[a]);
+            __m128 t_far  = _mm_mul_ps(_mm_sub_ps(b_far, o[a]), inv[a]);
+            t0 = _mm_max_ps(t_near, t0);
+            t1 = _mm_min_ps(t_far, t1);
+        }
+        mask = _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+        _mm_storeu_ps(t_enter, t0);
+#else
+        for (int i = 0; i < width; i++) {
+            float t0 = static_cast<float>(t_min), t1 = t_hi;
+            for (int a = 0; a < 3; a++) {
+                float b_near = node.bounds[near_row[a]][i];
+                float b_far  = node.bounds[far_row[a]][i];
+                if constexpr (moving) {
+                    b_near += motion[index].delta[near_row[a]][i] * s;
+                    b_far  += motion[index].delta[far_row[a]][i] * s;
+                }
+                float t_near = (b_near - origin[a]) * inv_dir[a];
+                float t_far  = (b_far - origin[a]) * inv_dir[a];
+                t0 = t_near > t0 ? t_near : t0;
+                t1 = t_far < t1 ? t_far : t1;
+            }
+            t_enter[i] = t0;
+            if (t0 <= t1)
+                mask |= 1 << i;
+        }
+#endif
+
+        // leaves are intersected right away, interior children pushed far to near
+        int interior[width];
+        int num_interior = 0;
+
+        for (int i = 0; i < width; i++) {
+            if (!(mask & (1 << i)) || node.count[i] < 0)
+                continue;
+
+            if (node.count[i] == 0) {
+                interior[num_interior++] = i;
+                continue;
+            }
+
+            for (int p = node.child[i]; p < node.child[i] + node.count[i]; p++) {
+                if constexpr (any_hit) {
+                    if (primitives[p]->occluded(r, t_min, closest))
+                        return true;
+                } else if (primitives[p]->hit(r, t_min, closest, *rec)) {
+                    hit_anything = true;
+                    closest = rec->t;
+                }
+            }
+        }
+
+        // sort by entry distance, nearest last so it comes off the stack first
+        for (int i = 1; i < num_interior; i++)
+            for (int j = i; j > 0 && t_enter[interior[j]] > t_enter[interior[j-1]]; j--)
+                std::swap(interior[j], interior[j-1]);
+
+        for (int i = 0; i < num_interior; i++)
+            stack.push(node.child[interior[i]]);
+    }
+
+    return hit_anything;
+}
+
+
+inline void wide_bvh::refit(double time0, double time1) {
+    if (nodes.empty())
+        return;
+
+    // whatever moved underneath the leaves first - each primitive has one slot, so they're
+    // independent of each other
+    bvh_parallel_for(options, owned.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            owned[i]->refit(time0, time1);
+    });
+
+    shutter_open = time0;
+    inv_shutter = time1 > time0 ? 1.0 / (time1 - time0) : 0;
+    motion.resize(nodes.size());
+
+    // leaf lanes only read their own primitives, so they go in parallel too
+    std::vector<aabb> lane0(nodes.size() * width), lane1(nodes.size() * width);
+    bvh_parallel_for(options, nodes.size(), [&](size_t begin, size_t end) {
+        for (size_t n = begin; n < end; n++)
+            for (int i = 0; i < width; i++)
+                if (nodes[n].count[i] > 0)
+                    leaf_boxes(nodes[n].child[i], nodes[n].count[i], time0, time1,
+                               lane0[n * width + i], lane1[n * width + i]);
+    });
+
+    // then interior lanes bottom up, a subtree per task
+    std::vector<aabb> box0(nodes.size()), box1(nodes.size());
+    auto children = [&](size_t n, auto f) {
+        for (int i = 0; i < width && nodes[n].count[i] >= 0; i++)
+            if (nodes[n].count[i] == 0)
+                f(static_cast<size_t>(nodes[n].child[i]));
+    };
+    bvh_refit_interior(options, nodes.size(), children, [&](size_t n) {
+        for (int i = 0; i < width && nodes[n].count[i] >= 0; i++) {
+            aabb& b0 = lane0[n * width + i];
+            aabb& b1 = lane1[n * width + i];
+            if (nodes[n].count[i] == 0) {
+                b0 = box0[nodes[n].child[i]];
+                b1 = box1[nodes[n].child[i]];
+            }
+
+            set_lane(static_cast<int>(n), i, b0, b1);
+            box0[n] = i == 0 ? b0 : surrounding_box(box0[n], b0);
+            box1[n] = i == 0 ? b1 : surrounding_box(box1[n], b1);
+        }
+    });
+
+    drop_static_motion();
+    root_box = surrounding_box(box0[0], box1[0]);
+
+    // refitting keeps boxes tight but not the tree's shape - once things have moved far enough
+    // that the boxes overlap badly, build again over the same primitives
+    double cost = sah_cost();
+    if (cost > built_cost * (1 + options.rebuild_threshold)) {
+        hittable_list list;
+        list.objects = owned;
+
+        bvh_options rebuild_options = options;
+        rebuild_options.report = false;
+        build(make_shared<bvh_node>(list, time0, time1, rebuild_options), time0, time1);
+
+        if (options.report)
+            std::cout << "refit SAH cost " << cost << " was past " << 1 + options.rebuild_threshold
+                      << "x the built tree's, rebuilt over " << list.objects.size()
+                      << " objects, SAH cost now " << built_cost << std::endl;
+    }
+}
+
+
+inline double wide_bvh::sah_cost() const {
+    if (nodes.empty())
+        return 0;
+
+    const double root_area = root_box.area();
+
+    // a node's test is paid whenever the lane pointing at it is hit, the root's always
+    double cost = options.traversal_cost;
+    for (size_t n = 0; n < nodes.size(); n++) {
+        for (int i = 0; i < width && nodes[n].count[i] >= 0; i++) {
+            vec3 extent;
+            for (int a = 0; a < 3; a++) {
+                double d_min = motion.empty() ? 0 : fmin(motion[n].delta[a][i], 0.0f);
+                double d_max = motion.empty() ? 0 : fmax(motion[n].delta[a + 3][i], 0.0f);
+                extent[a] = (nodes[n].bounds[a + 3][i] + d_max) - (nodes[n].bounds[a][i] + d_min);
+            }
+
+            double area = 2 * (extent.x()*extent.y() + extent.y()*extent.z() + extent.z()*extent.x());
+            double p = root_area > 0 ? area / root_area : 1;
+            cost += nodes[n].count[i] == 0 ? options.traversal_cost * p
+                                           : options.intersection_cost * p * nodes[n].count[i];
+        }
+    }
+
+    return cost;
+}
+
+
+inline bool wide_bvh::bounding_box(double t0, double t1, aabb& output_box) const {
+    output_box = root_box;
+    return !nodes.empty();
+}
+
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef CORE_INCLUDES
+#define CORE_INCLUDES
+
+// everything the renderer itself needs - no SDL, OpenGL or ImGui in here, so
+// this (and the book code) builds on machines without a display
+
+#include <stdio.h>
+
+//stl includes
+#include <vector>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+//#include <filesystem>
+
+//iostream aliases
+using std::cin;
+using std::cout;
+using std::cerr;
+
+using std::flush;
+using std::endl;
+
+//png loading library - very powerful
+#include "lodepng.h"
+
+//persistent worker threads for the sample passes
+#include "thread_pool.h"
+
+//tiles of the image handed out to the workers, with work stealing
+#include "tile_scheduler.h"
+
+#define NUM_SAMPLES_DEFAULT 1024
+#define NUM_THREADS_DEFAULT 0 // 0 means use std::thread::hardware_concurrency()
+#define TILE_SIZE 16
+#define AUTO_BVH_MIN_OBJECTS 4 // worlds with fewer top level objects than this stay a plain list
+#define AUTO_BVH_MAX_COST 0.75 // and bigger ones only get a BVH if it's at most this fraction of the list's SAH cost
+#define WIDTH_DEFAULT 256
+#define HEIGHT_DEFAULT 256
+#define SCENE_DEFAULT 8 // cornell_smoke
+#define GAMMA_DEFAULT 0.5f
+#define MAX_DEPTH_DEFAULT 50 // longest path, in segments
+#define RR_DEPTH_DEFAULT 3 // bounces before russian roulette can end a path
+#define TARGET_ERROR_DEFAULT 0.0 // relative error a tile stops sampling at, 0 samples every pixel to the full count
+#define MIN_SAMPLES_DEFAULT 16 // samples before a tile can be judged converged
+#define FRAMES_DEFAULT 1 // more than one renders the scene's animation, a numbered image per frame
+#define FRAME_RATE 24.0 // frames per second of scene time, a frame's exposure is the camera shutter
+
+// precision of the per-pixel running sums - float halves the memory, build
+// with -DACCUMULATOR_TYPE=double for very long renders
+#ifndef ACCUMULATOR_TYPE
+#define ACCUMULATOR_TYPE float
+#endif
+
+//flat, row-major accumulation buffer with separate R/G/B planes
+#include "framebuffer.h"
+
+//image size, sample count, thread count and so on, from the command line
+#include "render_settings.h"
+
+#endif
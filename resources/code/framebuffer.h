@@ -0,0 +1,179 @@
+#ifndef FRAMEBUFFER
+#define FRAMEBUFFER
+
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <new>
+#include <algorithm>
+
+// allocator that hands out cache-line aligned storage, so every plane of the
+// framebuffer starts on a 64 byte boundary and vectorizes cleanly
+template <typename T, size_t alignment = 64>
+struct aligned_allocator
+{
+    typedef T value_type;
+
+    template <typename U> struct rebind { typedef aligned_allocator<U, alignment> other; };
+
+    aligned_allocator() = default;
+    template <typename U> aligned_allocator(const aligned_allocator<U, alignment>&) {}
+
+    T* allocate(size_t n)
+    {
+        size_t bytes = ((n * sizeof(T) + alignment - 1) / alignment) * alignment;
+        void* p = std::aligned_alloc(alignment, bytes);
+        if(!p) throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* p, size_t) { std::free(p); }
+
+    template <typename U> bool operator==(const aligned_allocator<U, alignment>&) const { return true; }
+    template <typename U> bool operator!=(const aligned_allocator<U, alignment>&) const { return false; }
+};
+
+
+// flat, row-major accumulation target - one contiguous allocation, split into
+// separate red, green and blue planes (pixel (x,y) is element y*width + x of
+// each plane). T picks the precision of the running sums. A fourth plane sums
+// the squared luminance of the samples, and each pixel keeps its own sample
+// count, so the variance of every pixel can be estimated as it goes - pixels
+// don't all have the same number of samples once adaptive sampling stops some
+template <typename T>
+class planar_framebuffer
+{
+public:
+
+    void resize(int w, int h)
+    {
+        width = w;
+        height = h;
+
+        // pad each plane out to a whole number of cache lines
+        const size_t per_line = 64 / sizeof(T);
+        stride = ((static_cast<size_t>(w) * h + per_line - 1) / per_line) * per_line;
+
+        data.assign(4 * stride, T(0));
+        counts.assign(stride, 0);
+    }
+
+    void clear()
+    {
+        std::fill(data.begin(), data.end(), T(0));
+        std::fill(counts.begin(), counts.end(), 0);
+    }
+
+    int get_width() const  { return width; }
+    int get_height() const { return height; }
+    size_t pixel_count() const { return static_cast<size_t>(width) * height; }
+
+    size_t index(int x, int y) const { return static_cast<size_t>(y) * width + x; }
+
+    T* red()   { return data.data(); }
+    T* green() { return data.data() + stride; }
+    T* blue()  { return data.data() + 2 * stride; }
+
+    const T* red() const   { return data.data(); }
+    const T* green() const { return data.data() + stride; }
+    const T* blue() const  { return data.data() + 2 * stride; }
+
+    const uint32_t* sample_counts() const { return counts.data(); }
+
+    void add(int x, int y, double r, double g, double b)
+    {
+        size_t i = index(x, y);
+        double l = luminance(r, g, b);
+        data[i]              += static_cast<T>(r);
+        data[i + stride]     += static_cast<T>(g);
+        data[i + 2 * stride] += static_cast<T>(b);
+        data[i + 3 * stride] += static_cast<T>(l * l);
+        counts[i]++;
+    }
+
+    // copy the pixels in [x0,x1) x [y0,y1) over from a buffer of the same size - all four
+    // planes and the counts, a row at a time
+    void copy_region(const planar_framebuffer& from, int x0, int y0, int x1, int y1)
+    {
+        for(int y = y0; y < y1; y++)
+        {
+            size_t begin = index(x0, y), end = index(x1, y);
+            for(int plane = 0; plane < 4; plane++)
+                std::copy(from.data.begin() + plane * stride + begin, from.data.begin() + plane * stride + end,
+                          data.begin() + plane * stride + begin);
+            std::copy(from.counts.begin() + begin, from.counts.begin() + end, counts.begin() + begin);
+        }
+    }
+
+    // standard error of the pixel's mean luminance, relative to that mean (floored,
+    // so black pixels aren't held to an impossible standard) - infinite until the
+    // pixel has two samples to estimate a variance from
+    double relative_error(int x, int y) const
+    {
+        size_t i = index(x, y);
+        double n = counts[i];
+        if(n < 2)
+            return INFINITY;
+
+        double mean = luminance(data[i], data[i + stride], data[i + 2 * stride]) / n;
+        double variance = std::max(data[i + 3 * stride] / n - mean * mean, 0.0) * n / (n - 1);
+
+        return std::sqrt(variance / n) / std::max(mean, 1e-3);
+    }
+
+    // average each pixel over its own sample count, gamma correct and append as 8-bit
+    // RGBA - rows go bottom to top (the way glTexImage2D wants them) unless top_down
+    // is set (for PNG)
+    void resolve(std::vector<unsigned char>& out, float gamma, bool top_down = false) const
+    {
+        out.resize(pixel_count() * 4);
+
+        unsigned char* dst = out.data();
+        for(int row = 0; row < height; row++)
+        {
+            int y = top_down ? height - 1 - row : row;
+
+            const T* r = red()   + index(0, y);
+            const T* g = green() + index(0, y);
+            const T* b = blue()  + index(0, y);
+            const uint32_t* n = sample_counts() + index(0, y);
+
+            for(int x = 0; x < width; x++)
+            {
+                const T scale = n[x] ? T(1) / static_cast<T>(n[x]) : T(0);
+                *dst++ = to_byte(r[x] * scale, gamma);
+                *dst++ = to_byte(g[x] * scale, gamma);
+                *dst++ = to_byte(b[x] * scale, gamma);
+                *dst++ = 255;
+            }
+        }
+    }
+
+private:
+
+    static double luminance(double r, double g, double b) { return 0.2126 * r + 0.7152 * g + 0.0722 * b; }
+
+    static unsigned char to_byte(T v, float gamma)
+    {
+        // Replace NaN components with zero. See explanation in Ray Tracing: The Rest of Your Life.
+        if (v != v) v = T(0);
+
+        //more flexible gamma correction
+        double c = std::pow(static_cast<double>(v), static_cast<double>(gamma));
+        return static_cast<unsigned char>(256 * std::min(std::max(c, 0.0), 0.999));
+    }
+
+    int width = 0;
+    int height = 0;
+    size_t stride = 0;
+
+    std::vector<T, aligned_allocator<T>> data;
+    std::vector<uint32_t, aligned_allocator<uint32_t>> counts;
+};
+
+// the buffer the renderer accumulates into
+typedef planar_framebuffer<ACCUMULATOR_TYPE> accumulation_buffer;
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  headless.cc
+ *
+ *    Description:  batch entry point - builds the scene, renders the full sample
+ *                  budget on every core and writes the image, with no window,
+ *                  OpenGL context or ImGui, for running on render nodes
+ *
+ * =====================================================================================
+ */
+
+
+#include "renderer.h"
+
+int main(int argc, char *argv[])
+{
+    render_settings settings;
+    if(!parse_settings(argc, argv, settings))
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    renderer r(settings);
+
+    cout << "rendering " << r.get_image_width() << "x" << r.get_image_height() << " at " << settings.num_samples << " samples, with " << r.get_thread_count() << " worker threads" << endl;
+
+    if(settings.frames > 1)
+    {
+        if(!r.set_frame(0))
+        {
+            cout << "scene " << settings.scene << " doesn't animate" << endl;
+            return 1;
+        }
+
+        // the number goes in before the extension - save.png becomes save_0000.png, ...
+        std::string name = settings.output, extension;
+        size_t dot = name.find_last_of('.');
+        if(dot != std::string::npos && name.find('/', dot) == std::string::npos)
+        {
+            extension = name.substr(dot);
+            name.resize(dot);
+        }
+
+        for(int frame = 0; frame < settings.frames; frame++)
+        {
+            if(frame > 0)
+                r.set_frame(frame);
+            r.run();
+
+            char number[16];
+            snprintf(number, sizeof(number), "_%04d", frame);
+            cout << "frame " << frame << " traced in " << r.total_time << "ms" << endl;
+            if(!r.save_png(name + number + extension, GAMMA_DEFAULT))
+                return 1;
+        }
+
+        r.get_path_stats().print(cout);
+        return 0;
+    }
+
+    r.run();
+
+    cout << "total tracing time " << r.total_time << "ms" << endl;
+    r.get_path_stats().print(cout);
+
+    return r.save_png(settings.output, GAMMA_DEFAULT) ? 0 : 1;
+}
@@ -1,33 +1,8 @@
 #ifndef INCLUDES
 #define INCLUDES
 
-#include <stdio.h>
-
-//stl includes
-#include <vector>
-#include <cmath>
-#include <numeric>
-#include <random>
-#include <algorithm>
-#include <iostream>
-#include <fstream>
-#include <string>
-#include <sstream>
-#include <vector>
-#include <deque>
-#include <thread>
-#include <chrono>
-#include <cstdint>
-#include <cstdlib>
-//#include <filesystem>
-
-//iostream aliases
-using std::cin;
-using std::cout;
-using std::cerr;
-
-using std::flush;
-using std::endl;
+//the renderer core - stl, lodepng, thread pool, framebuffer, settings
+#include "core_includes.h"
 
 //vector math library GLM
 #define GLM_FORCE_SWIZZLE
@@ -56,9 +31,6 @@ using std::endl;
 #include <SDL2/SDL_opengl.h>
 
 
-//png loading library - very powerful
-#include "lodepng.h"
-
 //shader compilation wrapper - may need to be extended
 #include "shader.h"
 
@@ -68,8 +40,4 @@ using std::endl;
 //diamond square heightmap generation
 #include "diamond_square.h"
 
-#define NUM_SAMPLES_DEFAULT 1024
-#define WIDTH 256
-#define HEIGHT 256
-
 #endif
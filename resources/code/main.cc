@@ -19,6 +19,13 @@
 
 int main(int argc, char *argv[])
 {
-    rttnw r;
+    render_settings settings;
+    if(!parse_settings(argc, argv, settings))
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    rttnw r(settings);
     return 0;
 }
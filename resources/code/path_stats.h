@@ -0,0 +1,70 @@
+#ifndef PATH_STATS
+#define PATH_STATS
+
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+// counters kept by the integrator - one set per worker (cache line aligned, so
+// the workers don't share lines), merged once a pass is done
+
+struct alignas(64) path_stats
+{
+    unsigned long paths = 0;
+    unsigned long segments = 0;         // rays traced, over all depths
+    unsigned long shadow_rays = 0;      // towards sampled lights
+
+    // how paths ended
+    unsigned long escaped = 0;          // left the scene
+    unsigned long absorbed = 0;         // hit something that doesn't scatter (lights, mostly)
+    unsigned long roulette = 0;         // killed by russian roulette
+    unsigned long depth_limit = 0;      // ran into max_depth
+
+    std::vector<unsigned long> rays_at_depth;   // paths that got as far as each bounce
+
+    void reset(int max_depth)
+    {
+        *this = path_stats();
+        rays_at_depth.assign(max_depth, 0);
+    }
+
+    void merge(const path_stats& other)
+    {
+        paths       += other.paths;
+        segments    += other.segments;
+        shadow_rays += other.shadow_rays;
+        escaped     += other.escaped;
+        absorbed    += other.absorbed;
+        roulette    += other.roulette;
+        depth_limit += other.depth_limit;
+
+        if(rays_at_depth.size() < other.rays_at_depth.size())
+            rays_at_depth.resize(other.rays_at_depth.size(), 0);
+        for(size_t i = 0; i < other.rays_at_depth.size(); i++)
+            rays_at_depth[i] += other.rays_at_depth[i];
+    }
+
+    double mean_length() const { return paths ? static_cast<double>(segments) / paths : 0.0; }
+
+    void print(std::ostream& out) const
+    {
+        if(paths == 0)
+            return;
+
+        auto percent = [this](unsigned long n){ return 100.0 * n / paths; };
+
+        out << std::fixed << std::setprecision(2)
+            << "paths " << paths << ", mean length " << mean_length() << " segments, "
+            << static_cast<double>(shadow_rays) / paths << " shadow rays" << std::endl
+            << "  escaped " << percent(escaped) << "%, absorbed " << percent(absorbed)
+            << "%, roulette " << percent(roulette) << "%, depth limit " << percent(depth_limit) << "%" << std::endl;
+
+        // surviving fraction at each depth, until it drops under a hundredth of a percent
+        out << "  alive at depth:";
+        for(size_t d = 0; d < rays_at_depth.size() && percent(rays_at_depth[d]) >= 0.01; d++)
+            out << " " << d << ":" << percent(rays_at_depth[d]) << "%";
+        out << std::defaultfloat << std::setprecision(6) << std::endl;
+    }
+};
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef RENDER_SETTINGS
+#define RENDER_SETTINGS
+
+#include <string>
+#include <cstdlib>
+#include <iostream>
+
+// startup configuration for a render - defaults come from core_includes.h, and
+// can be overridden on the command line, e.g.
+//    ./headless --width 3840 --height 2160 --samples 256 --threads 64 --output frame.png
+struct render_settings
+{
+    int image_width  = WIDTH_DEFAULT;
+    int image_height = HEIGHT_DEFAULT;
+    int num_samples  = NUM_SAMPLES_DEFAULT;
+    int num_threads  = NUM_THREADS_DEFAULT;   // 0 means one per hardware thread
+    int scene        = SCENE_DEFAULT;         // which of the scenes in book_code.h
+    int max_depth    = MAX_DEPTH_DEFAULT;
+    int rr_depth     = RR_DEPTH_DEFAULT;      // set it to max_depth or more to turn roulette off
+    double target_error = TARGET_ERROR_DEFAULT;   // adaptive sampling, num_samples becomes the most any pixel gets
+    int min_samples  = MIN_SAMPLES_DEFAULT;
+    int frames       = FRAMES_DEFAULT;        // headless only - animated scenes write output_0000.png on
+    bool light_sampling = true;               // next event estimation towards emissive objects
+
+    std::string sampler = "sobol";            // random, sobol or dither - see book_code/sampler.h
+
+    std::string bvh = "wide";                 // acceleration structure layout - binary, linear, wide or compressed
+    std::string builder = "sah";              // how its tree is built - sah, morton (fast) or median (the book's)
+    std::string bvh_cache;                    // directory built BVHs are kept in between runs - empty for none
+
+    std::string output = "save.png";
+
+    double aspect_ratio() const { return static_cast<double>(image_width) / static_cast<double>(image_height); }
+};
+
+inline void print_usage(const char* program)
+{
+    std::cout << "usage: " << program << " [--width W] [--height H] [--samples N] [--threads T] [--scene 1-10] [--max-depth D] [--rr-depth D] [--target-error E] [--min-samples N] [--frames N] [--nee 0|1] [--sampler random|sobol|dither] [--bvh binary|linear|wide|compressed] [--builder sah|morton|median] [--bvh-cache dir] [--output file.png]" << std::endl;
+}
+
+// returns false on anything it doesn't understand
+inline bool parse_settings(int argc, char* argv[], render_settings& settings)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+
+        if(i + 1 >= argc)
+        {
+            std::cerr << "missing value for " << arg << std::endl;
+            return false;
+        }
+
+        std::string value_string = argv[++i];
+        int value = std::atoi(value_string.c_str());
+
+        if(arg == "--output" || arg == "-o")
+            settings.output = value_string;
+        else if(arg == "--width" || arg == "-w")
+            settings.image_width = value;
+        else if(arg == "--height" || arg == "-h")
+            settings.image_height = value;
+        else if(arg == "--samples" || arg == "-s")
+            settings.num_samples = value;
+        else if(arg == "--threads" || arg == "-t")
+            settings.num_threads = value;
+        else if(arg == "--scene")
+            settings.scene = value;
+        else if(arg == "--max-depth")
+            settings.max_depth = value;
+        else if(arg == "--rr-depth")
+            settings.rr_depth = value;
+        else if(arg == "--target-error")
+            settings.target_error = std::atof(value_string.c_str());
+        else if(arg == "--min-samples")
+            settings.min_samples = value;
+        else if(arg == "--frames")
+            settings.frames = value;
+        else if(arg == "--nee")
+            settings.light_sampling = value != 0;
+        else if(arg == "--sampler")
+            settings.sampler = value_string;
+        else if(arg == "--bvh")
+            settings.bvh = value_string;
+        else if(arg == "--builder")
+            settings.builder = value_string;
+        else if(arg == "--bvh-cache")
+            settings.bvh_cache = value_string;
+        else
+        {
+            std::cerr << "unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+
+    if(settings.image_width < 2 || settings.image_height < 2 || settings.num_samples < 1 || settings.max_depth < 1)
+    {
+        std::cerr << "image must be at least 2x2, with at least one sample and a max depth of at least one" << std::endl;
+        return false;
+    }
+
+    if(settings.target_error < 0 || settings.min_samples < 2)
+    {
+        std::cerr << "target error can't be negative, and adaptive sampling needs at least two samples to judge a pixel by" << std::endl;
+        return false;
+    }
+
+    if(settings.frames < 1)
+    {
+        std::cerr << "need at least one frame" << std::endl;
+        return false;
+    }
+
+    if(settings.sampler != "random" && settings.sampler != "sobol" && settings.sampler != "dither")
+    {
+        std::cerr << "unknown sampler " << settings.sampler << std::endl;
+        return false;
+    }
+
+    if(settings.bvh != "binary" && settings.bvh != "linear" && settings.bvh != "wide"
+       && settings.bvh != "compressed")
+    {
+        std::cerr << "unknown bvh layout " << settings.bvh << std::endl;
+        return false;
+    }
+
+    if(settings.builder != "sah" && settings.builder != "morton" && settings.builder != "median")
+    {
+        std::cerr << "unknown bvh builder " << settings.builder << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,629 @@
+#include "renderer.h"
+// This is the tracing side of things - nothing in here knows about the window
+
+renderer::renderer(const render_settings& settings) : pool(settings.num_threads)
+{
+    image_width = settings.image_width;
+    image_height = settings.image_height;
+    num_samples = settings.num_samples;
+    max_depth = settings.max_depth;
+    rr_depth = settings.rr_depth;
+    light_sampling = settings.light_sampling;
+    target_error = settings.target_error;
+    min_samples = settings.min_samples;
+    sampling = settings.sampler == "random" ? sampler_type::random
+             : settings.sampler == "dither" ? sampler_type::dither
+                                            : sampler_type::sobol;
+
+    worker_stats.resize(pool.size());
+    for(auto& s : worker_stats)
+        s.reset(max_depth);
+    completed_stats.reset(max_depth);
+
+    accumulated_samples.resize(image_width, image_height);
+    completed_samples.resize(image_width, image_height);
+    active_tiles = tile_scheduler::make_tiles(image_width, image_height, TILE_SIZE);
+    tiles_sampling = static_cast<int>(active_tiles.size());
+
+    // scenes with a BVH build it on the worker pool
+    scene_bvh.pool = &pool;
+    scene_bvh.layout = settings.bvh == "binary"     ? bvh_layout::binary
+                     : settings.bvh == "linear"     ? bvh_layout::linear
+                     : settings.bvh == "compressed" ? bvh_layout::compressed
+                                                    : bvh_layout::wide;
+    scene_bvh.builder = settings.builder == "morton" ? bvh_builder::morton
+                      : settings.builder == "median" ? bvh_builder::median
+                                                     : bvh_builder::sah;
+    scene_bvh.cache_dir = settings.bvh_cache;
+
+    load_scene(settings.scene);
+}
+
+renderer::~renderer()
+{
+    stop();
+}
+
+
+void renderer::load_scene(int scene)
+{
+	    point3 lookfrom;
+	    point3 lookat;
+	    vec3 vup(0,1,0);
+	    auto vfov = 40.0;
+	    auto aperture = 0.0;
+	    auto dist_to_focus = 10.0;
+	    background = color(0,0,0);
+	    animate = nullptr;
+
+	    switch (scene) {
+	        case 1:
+	            world = random_scene(scene_bvh, &animate);
+	            lookfrom = point3(13,2,3);
+	            lookat = point3(0,0,0);
+	            vfov = 20.0;
+	            background = color(0.70, 0.80, 1.00);
+	            break;
+
+	        case 2:
+	            world = two_spheres();
+	            lookfrom = point3(13,2,3);
+	            lookat = point3(0,0,0);
+	            vfov = 20.0;
+	            background = color(0.70, 0.80, 1.00);
+	            break;
+
+	        case 3:
+	            world = two_perlin_spheres();
+	            lookfrom = point3(13,2,3);
+	            lookat = point3(0,0,0);
+	            vfov = 20.0;
+	            background = color(0.70, 0.80, 1.00);
+	            break;
+
+	        case 4:
+	            world = earth();
+	            lookfrom = point3(0,0,12);
+	            lookat = point3(0,0,0);
+	            vfov = 20.0;
+	            background = color(0.70, 0.80, 1.00);
+	            break;
+
+	        case 5:
+	            world = simple_light();
+	            lookfrom = point3(26,3,6);
+	            lookat = point3(0,2,0);
+	            vfov = 20.0;
+	            break;
+
+	        default:
+	        case 6:
+	            world = cornell_box(&animate);
+	            lookfrom = point3(278, 278, -800);
+	            lookat = point3(278, 278, 0);
+	            vfov = 40.0;
+	            break;
+
+	        case 7:
+	            world = cornell_balls();
+	            lookfrom = point3(278, 278, -800);
+	            lookat = point3(278, 278, 0);
+	            vfov = 40.0;
+	            break;
+
+	        case 8:
+	            world = cornell_smoke();
+	            lookfrom = point3(278, 278, -800);
+	            lookat = point3(278, 278, 0);
+	            vfov = 40.0;
+	            break;
+
+	        case 9:
+	            world = cornell_final();
+	            lookfrom = point3(278, 278, -800);
+	            lookat = point3(278, 278, 0);
+	            vfov = 40.0;
+	            break;
+
+	        case 10:
+	            world = final_scene(scene_bvh, &animate);
+	            lookfrom = point3(478, 278, -600);
+	            lookat = point3(278, 278, 0);
+	            vfov = 40.0;
+	            break;
+	    }
+
+    // keep the view around, so the camera can be rebuilt when the aspect ratio changes
+    view_lookfrom = lookfrom;
+    view_lookat = lookat;
+    view_vup = vup;
+    view_vfov = vfov;
+    view_aperture = aperture;
+    view_focus_dist = dist_to_focus;
+
+    update_camera();
+
+    accelerate_world();
+
+    // find the emitters, so they can be sampled directly
+    lights.clear();
+    if(light_sampling)
+        world.collect_lights(lights);
+    cout << lights.size() << " light" << (lights.size() == 1 ? "" : "s") << " to sample" << endl;
+}
+
+
+void renderer::accelerate_world()
+{
+    if(world.objects.size() < AUTO_BVH_MIN_OBJECTS)
+    {
+        cout << "world is " << world.objects.size() << " top level object" << (world.objects.size() == 1 ? "" : "s")
+             << ", leaving it as a list" << endl;
+        return;
+    }
+
+    // anything without a box (nothing in the current scenes) has to stay outside the BVH
+    hittable_list bounded, accelerated;
+    for(const auto& object : world.objects)
+    {
+        aabb box;
+        if(object->bounding_box(0.0, 1.0, box))
+            bounded.add(object);
+        else
+            accelerated.add(object);
+    }
+
+    if(bounded.objects.size() < AUTO_BVH_MIN_OBJECTS)
+    {
+        cout << "world of " << world.objects.size() << " top level objects left as a list - only "
+             << bounded.objects.size() << " with a bounding box, " << accelerated.objects.size() << " without" << endl;
+        return;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    bvh_options options = scene_bvh;
+    options.report = false;
+    auto tree = make_shared<bvh_node>(bounded, 0.0, 1.0, options);
+
+    // a few big overlapping objects (the walls of a Cornell box) gain nothing from a tree,
+    // and the rays inside them pay for the extra boxes - the SAH cost says as much, where
+    // timing camera rays alone wouldn't
+    double tree_cost = bvh_sah_cost(tree, options);
+    double list_cost = options.intersection_cost * bounded.objects.size();
+    if(tree_cost > AUTO_BVH_MAX_COST * list_cost)
+    {
+        cout << "world of " << world.objects.size() << " top level objects left as a list - SAH cost "
+             << tree_cost << " with a BVH, " << list_cost << " without" << endl;
+        return;
+    }
+
+    accelerated.add(make_bvh(tree, 0.0, 1.0, scene_bvh));
+    auto end = std::chrono::high_resolution_clock::now();
+    double build_ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+    // what that does for a pass worth of camera rays - bounces only add to it
+    const int probe_rays = 4096;
+    double before = time_camera_rays(world, probe_rays);
+    double after = time_camera_rays(accelerated, probe_rays);
+    double saved_ms = (before - after) * image_width * image_height * 1e-6;
+
+    cout << "world of " << world.objects.size() << " top level objects accelerated in " << build_ms << "ms, SAH cost "
+         << tree_cost << " down from " << list_cost << " - " << before << "ns per camera ray before, " << after
+         << "ns after, about " << saved_ms << "ms saved per pass on camera rays alone" << endl;
+
+    world = accelerated;
+}
+
+
+// nanoseconds per closest hit query, for a spread of camera rays
+double renderer::time_camera_rays(const hittable& h, int count)
+{
+    std::vector<ray> rays;
+    for(int i = 0; i < count; i++)
+        rays.push_back(cam.get_ray(random_double(), random_double()));
+
+    // volatile, so the loop can't be optimized out
+    volatile int hits = 0;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for(const auto& r : rays)
+    {
+        hit_record rec;
+        if(h.hit(r, 0.001, infinity, rec))
+            hits = hits + 1;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    return std::chrono::duration<double, std::nano>(end - start).count() / count;
+}
+
+
+void renderer::update_camera()
+{
+    const auto aspect_ratio = static_cast<double>(image_width) / static_cast<double>(image_height);
+    cam = camera(view_lookfrom, view_lookat, view_vup, view_vfov, aspect_ratio, view_aperture, view_focus_dist, 0.0, 1.0);
+}
+
+
+void renderer::start()
+{
+    stop_requested = false;
+    render_finished = false;
+    render_thread = std::thread(&renderer::run, this);
+}
+
+
+void renderer::stop()
+{
+    // the render thread stops at the end of its current pass
+    stop_requested = true;
+    if(render_thread.joinable())
+        render_thread.join();
+}
+
+
+void renderer::resize(int width, int height)
+{
+    bool was_running = render_thread.joinable();
+    stop();
+
+    image_width = width;
+    image_height = height;
+
+    // start over, at the new size
+    reset_image();
+    update_camera();
+
+    cout << "image size is now " << image_width << "x" << image_height << endl;
+
+    if(was_running)
+        start();
+}
+
+
+bool renderer::set_frame(int frame)
+{
+    if(!animate)
+        return false;
+
+    // boxes are refit over the trees the scene was built with - the BVHs rebuild themselves
+    // if that leaves them too far from what a fresh build would give
+    auto start = std::chrono::high_resolution_clock::now();
+    animate(frame / FRAME_RATE, 1.0 / FRAME_RATE);
+    world.refit(0.0, 1.0);
+    auto end = std::chrono::high_resolution_clock::now();
+
+    cout << "frame " << frame << ", scene refit in "
+         << std::chrono::duration<double, std::milli>(end - start).count() << "ms" << endl;
+
+    reset_image();
+    return true;
+}
+
+
+void renderer::reset_image()
+{
+    accumulated_samples.resize(image_width, image_height);
+    active_tiles = tile_scheduler::make_tiles(image_width, image_height, TILE_SIZE);
+    tiles_sampling = static_cast<int>(active_tiles.size());
+    {
+        std::lock_guard<std::mutex> lock(completed_mutex);
+        completed_samples.resize(image_width, image_height);
+        completed_count = 0;
+        completed_stats.reset(max_depth);
+        completed_generation++;
+    }
+    sample_count = 0;
+    total_time = 0;
+}
+
+
+bool renderer::snapshot(std::vector<unsigned char>& rgba, int& width, int& height, float gamma, unsigned long& generation)
+{
+    std::lock_guard<std::mutex> lock(completed_mutex);
+    if(completed_generation == generation || completed_count == 0)
+        return false;
+
+    generation = completed_generation;
+    completed_samples.resolve(rgba, gamma);
+    width = completed_samples.get_width();
+    height = completed_samples.get_height();
+    return true;
+}
+
+
+bool renderer::save_png(const std::string& filename, float gamma)
+{
+    //average the samples and create your output using LodePNG
+    std::vector<unsigned char> tex_data;
+
+    // average the samples per pixel, rows from the top down for the PNG
+    {
+        std::lock_guard<std::mutex> lock(completed_mutex);
+        completed_samples.resolve(tex_data, gamma, true);
+    }
+
+    unsigned error = lodepng::encode(filename.c_str(), tex_data, image_width, image_height);
+
+    if(error) std::cout << "encode error during save(\" "+ filename +" \") " << error << ": " << lodepng_error_text(error) << std::endl;
+
+    return !error;
+}
+
+path_stats renderer::get_path_stats()
+{
+    std::lock_guard<std::mutex> lock(completed_mutex);
+    return completed_stats;
+}
+
+
+// power heuristic weight for a sample from the strategy with density f, when g was
+// the other way it could have been found
+static inline double power_heuristic(double f, double g)
+{
+    return (f * f) / (f * f + g * g);
+}
+
+
+// density of sample_lights() picking this light, then this direction towards it - zero for
+// emitters that aren't sampled. Each light's weight only counts the light itself, so an
+// emitter in front of the chosen one is plain occlusion to the shadow ray, and is found by
+// scattering with a weight that doesn't expect the shadow ray to have seen it
+double renderer::light_pdf(const hittable* light, const point3& o, const vec3& direction) const
+{
+    if(std::find(lights.begin(), lights.end(), light) == lights.end())
+        return 0.0;
+    return light->pdf_value(o, direction) / lights.size();
+}
+
+
+// one shadow ray towards a randomly chosen light, weighted against the chance that the
+// material would have scattered that way on its own
+color renderer::sample_lights(const ray& r_in, const hit_record& rec, const color& attenuation, path_stats& stats)
+{
+    const hittable* light = lights[random_int(0, static_cast<int>(lights.size()) - 1)];
+    vec3 direction = light->random(rec.p);
+    if(direction.length_squared() == 0)
+        return color(0,0,0);
+
+    double bsdf_pdf = rec.mat_ptr->scattering_pdf(r_in, rec, direction);
+    if(bsdf_pdf <= 0)
+        return color(0,0,0);    // behind the surface
+
+    double pdf = light_pdf(light, rec.p, direction);
+    if(pdf <= 0)
+        return color(0,0,0);
+
+    stats.shadow_rays++;
+
+    // find the point on the light first, then the any-hit query only has to say whether
+    // something is in the way
+    ray shadow(rec.p, direction, r_in.time());
+    hit_record light_rec;
+    if(!light->hit(shadow, 0.001, infinity, light_rec) || !light_rec.mat_ptr->is_emissive())
+        return color(0,0,0);
+
+    if(world.occluded(shadow, 0.001, light_rec.t * (1.0 - 1e-6)))
+        return color(0,0,0);
+
+    evaluate_surface(shadow, light_rec);
+    color emitted = light_rec.mat_ptr->emitted(light_rec.u, light_rec.v, light_rec.p);
+
+    // attenuation * bsdf_pdf is the BSDF times the cosine, for non-specular materials
+    return attenuation * emitted * (bsdf_pdf * power_heuristic(pdf, bsdf_pdf) / pdf);
+}
+
+
+// iterative path tracer - carries the product of the attenuations so far (throughput)
+// along the path, instead of recursing once per bounce. Past rr_depth, a path survives
+// each bounce with probability equal to its largest throughput component (capped at
+// 0.95) and is reweighted by 1/p when it does, which ends the low contribution tails
+// early without biasing the result
+//
+// With lights to sample, every non-specular hit also sends a shadow ray at one of them,
+// and emission found by scattering afterwards is weighted by multiple importance
+// sampling so the two ways of finding a light don't count it twice
+color renderer::trace_path(ray r, path_stats& stats)
+{
+    color radiance(0,0,0);
+    color throughput(1,1,1);
+
+    // density the last bounce was scattered with, zero for camera rays and specular bounces
+    double scatter_pdf = 0.0;
+    point3 scatter_origin;
+
+    stats.paths++;
+
+    for(int depth = 0; ; depth++)
+    {
+        // If we've exceeded the ray bounce limit, no more light is gathered.
+        if(depth >= max_depth)
+        {
+            stats.depth_limit++;
+            break;
+        }
+
+        stats.segments++;
+        stats.rays_at_depth[depth]++;
+
+        // this bounce's decisions get their own sampler dimensions
+        thread_sampler().start_bounce(depth);
+
+        hit_record rec;
+
+        // If the ray hits nothing, return the background color.
+        if(!world.hit(r, 0.001, infinity, rec))
+        {
+            radiance += throughput * background;
+            stats.escaped++;
+            break;
+        }
+
+        // only the closest hit gets its position, normal and UV worked out - what was hit,
+        // as the lights know it, is only on the record until then
+        const hittable* hit_object = rec.prim;
+        evaluate_surface(r, rec);
+
+        // shadow rays only count materials that say they emit, so only those get weighted
+        color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+        if(scatter_pdf > 0 && rec.mat_ptr->is_emissive())
+            emitted *= power_heuristic(scatter_pdf, light_pdf(hit_object, scatter_origin, r.direction()));
+        radiance += throughput * emitted;
+
+        ray scattered;
+        color attenuation;
+
+        if(!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
+        {
+            stats.absorbed++;
+            break;
+        }
+
+        if(!lights.empty() && !rec.mat_ptr->is_specular())
+        {
+            radiance += throughput * sample_lights(r, rec, attenuation, stats);
+            scatter_pdf = rec.mat_ptr->scattering_pdf(r, rec, scattered.direction());
+            scatter_origin = rec.p;
+        }
+        else
+        {
+            scatter_pdf = 0.0;
+        }
+
+        throughput = throughput * attenuation;
+
+        if(depth + 1 >= rr_depth)
+        {
+            double survive = fmin(fmax(throughput.x(), fmax(throughput.y(), throughput.z())), 0.95);
+            if(random_double() >= survive)
+            {
+                stats.roulette++;
+                break;
+            }
+            throughput /= survive;
+        }
+
+        r = scattered;
+    }
+
+    return radiance;
+}
+
+
+// a tile is done once the root mean square of its pixels' relative errors is under the
+// target - judging the tile as a whole means one unlucky, flat looking estimate doesn't
+// stop a pixel early while its neighbours are still finding the caustic, without a few
+// hard edge pixels holding the tile up forever either
+void renderer::drop_converged_tiles()
+{
+    auto converged = [this](const tile& t)
+    {
+        double sum = 0;
+        for(int y = t.y0; y < t.y1; y++)
+            for(int x = t.x0; x < t.x1; x++)
+            {
+                double e = accumulated_samples.relative_error(x, y);
+                sum += e * e;
+            }
+        return sum < target_error * target_error * (t.x1 - t.x0) * (t.y1 - t.y0);
+    };
+
+    active_tiles.erase(std::remove_if(active_tiles.begin(), active_tiles.end(), converged), active_tiles.end());
+    tiles_sampling = static_cast<int>(active_tiles.size());
+}
+
+
+void renderer::run()
+{
+    // runs flat out - when it's on its own thread, the workers never wait on the UI or vsync
+    while(!stop_requested && sample_count < num_samples && !active_tiles.empty())
+    {
+        // start a timer
+        auto start = std::chrono::high_resolution_clock::now();
+
+        // hand the tiles still sampling to the persistent workers - returns once
+        // every one of them has been traced
+        scheduler.reset(active_tiles, pool.size());
+        pool.run([this](int thread_index){ one_thread_sample(thread_index); });
+
+        // increment the sample count
+        sample_count++;
+
+        // publish the finished pass - front ends only ever read this copy, and only the
+        // tiles sampled in it have changed since the last one
+        {
+            std::lock_guard<std::mutex> lock(completed_mutex);
+            for(const tile& t : active_tiles)
+                completed_samples.copy_region(accumulated_samples, t.x0, t.y0, t.x1, t.y1);
+            completed_count = sample_count;
+            completed_generation++;
+
+            for(auto& s : worker_stats)
+            {
+                completed_stats.merge(s);
+                s.reset(max_depth);
+            }
+        }
+
+        if(target_error > 0 && sample_count >= min_samples)
+            drop_converged_tiles();
+
+        // stop that timer, add its value to the total time
+        auto end = std::chrono::high_resolution_clock::now();
+        int time_in_milliseconds = (int)std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(end - start).count();
+        last_sample_time = time_in_milliseconds;
+        total_time += time_in_milliseconds;
+
+        cout << "sample took " << time_in_milliseconds << "ms";
+        if(target_error > 0)
+            cout << ", " << active_tiles.size() << " tiles still sampling";
+        cout << endl;
+    }
+
+    if(target_error > 0)
+    {
+        const uint32_t* n = accumulated_samples.sample_counts();
+        double total = 0;
+        for(size_t i = 0; i < accumulated_samples.pixel_count(); i++)
+            total += n[i];
+
+        cout << (active_tiles.empty() ? "converged" : "stopped") << " at " << sample_count << " samples, "
+             << total / accumulated_samples.pixel_count() << " per pixel on average" << endl;
+    }
+
+    render_finished = true;
+}
+
+void renderer::one_thread_sample(int thread_index)
+{
+    // keep pulling tiles (own ones first, then stolen) until the pass is done
+    tile t;
+    while(scheduler.next(thread_index, t))
+    {
+        for(int y_coord = t.y0; y_coord < t.y1; y_coord++)
+        {
+            for(int x_coord = t.x0; x_coord < t.x1; x_coord++)
+            {
+                // every random number in this path comes from a stream keyed on pixel and
+                // sample index, so the result doesn't depend on which thread traced it - the
+                // sampler serves the dimensions it covers, the PCG stream anything past those
+                seed_random(static_cast<uint64_t>(y_coord) * image_width + x_coord, sample_count);
+                thread_sampler().start(sampling, x_coord, y_coord, sample_count);
+
+                double x_fl = (static_cast<double>(x_coord) + random_double())/(static_cast<double>(image_width-1));
+                double y_fl = (static_cast<double>(y_coord) + random_double())/(static_cast<double>(image_height-1));
+
+                ray r = cam.get_ray(x_fl, y_fl);
+
+                // figure out the color, put it in 'sample'
+                color sample = trace_path(r, worker_stats[thread_index]);
+
+                // add it to the running total for this pixel
+                accumulated_samples.add(x_coord, y_coord, sample.x(), sample.y(), sample.z());
+            }
+        }
+    }
+
+    // leave the worker on plain random numbers, for anything else it gets asked to do
+    thread_sampler().stop();
+}
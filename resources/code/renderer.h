@@ -0,0 +1,141 @@
+#ifndef RENDERER
+#define RENDERER
+
+#include "core_includes.h"
+#include "book_code.h"
+#include "path_stats.h"
+
+// the path tracer itself - scene, camera, worker pool and accumulation buffers,
+// with no window, GL context or ImGui. The GUI (rttnw) and the headless
+// executable are both just front ends over one of these
+
+class renderer
+{
+public:
+
+	renderer(const render_settings& settings = render_settings());
+	~renderer();
+
+	// trace passes on the calling thread (using the worker pool) until the
+	// sample budget is reached or stop() is called
+	void run();
+
+	// same thing, on a background thread
+	void start();
+	void stop();
+
+	// starts the image over at a new size - stops and restarts a background render
+	void resize(int width, int height);
+
+	// moves an animated scene to a frame and starts the image over, for run() to render -
+	// false, and nothing changes, for scenes that don't animate
+	bool set_frame(int frame);
+
+	// copy of the last completed pass as 8-bit RGBA, rows bottom to top - returns
+	// false if nothing has changed since the generation passed in
+	bool snapshot(std::vector<unsigned char>& rgba, int& width, int& height, float gamma, unsigned long& generation);
+
+	// average, gamma correct and write out the current image
+	bool save_png(const std::string& filename, float gamma);
+
+	int get_image_width() const  { return image_width; }
+	int get_image_height() const { return image_height; }
+	int get_thread_count() const { return pool.size(); }
+
+	// integrator counters, summed over every completed pass
+	path_stats get_path_stats();
+
+	std::atomic<int> num_samples{NUM_SAMPLES_DEFAULT};
+	std::atomic<int> sample_count{0};
+
+	// tiles adaptive sampling hasn't finished with yet
+	std::atomic<int> tiles_sampling{0};
+
+	std::atomic<int> last_sample_time{0};
+	std::atomic<long int> total_time{0};
+
+	std::atomic<bool> render_finished{false};
+
+private:
+
+	// path length limit, and the depth russian roulette starts at
+	int max_depth;
+	int rr_depth;
+
+    color background;
+
+	hittable_list world;
+	camera cam;
+
+	void load_scene(int scene);
+
+	// set by the scenes that animate, empty for the rest
+	scene_animation animate;
+
+	// clears the accumulation, sample counts and tiles, at the current image size
+	void reset_image();
+
+	// puts a BVH over the top level of the world when it has enough objects to be worth
+	// one, whatever the scene function returned - logs what it does for camera rays
+	void accelerate_world();
+	double time_camera_rays(const hittable& h, int count);
+
+	// how the scenes build their acceleration structures
+	bvh_options scene_bvh;
+	void update_camera();
+
+	// image size, changeable at runtime through resize()
+	int image_width;
+	int image_height;
+
+	// view of the current scene, used to rebuild the camera for a new aspect ratio
+	point3 view_lookfrom;
+	point3 view_lookat;
+	vec3 view_vup;
+	double view_vfov;
+	double view_aperture;
+	double view_focus_dist;
+
+	// adaptive sampling - once they have min_samples, tiles drop out of the passes when
+	// every pixel's relative error is under target_error (zero samples everything to num_samples)
+	double target_error;
+	int min_samples;
+	std::vector<tile> active_tiles;
+	void drop_converged_tiles();
+
+	void one_thread_sample(int thread_index);
+	color trace_path(ray r, path_stats& stats);
+
+	// everything in the scene that emits, for next event estimation - empty when
+	// it's turned off, or the scene is lit by the background alone
+	std::vector<const hittable*> lights;
+	bool light_sampling;
+
+	// where the random decisions in a path get their numbers from
+	sampler_type sampling;
+
+	double light_pdf(const hittable* light, const point3& o, const vec3& direction) const;
+	color sample_lights(const ray& r_in, const hit_record& rec, const color& attenuation, path_stats& stats);
+
+	// one set of counters per worker, merged into completed_stats after each pass
+	std::vector<path_stats> worker_stats;
+
+	// written by the workers during a pass
+	accumulation_buffer accumulated_samples;
+
+	// copy of the last completed pass, which is all a front end gets to look at
+	std::mutex completed_mutex;
+	accumulation_buffer completed_samples;
+	int completed_count = 0;
+	path_stats completed_stats;
+	unsigned long completed_generation = 0;
+
+	std::thread render_thread;
+	std::atomic<bool> stop_requested{false};
+
+	// created once, reused for every sample pass
+	thread_pool pool;
+	tile_scheduler scheduler;
+};
+
+#endif
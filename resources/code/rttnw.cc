@@ -2,15 +2,24 @@
 #include "debug.h"
 // This contains the very high level expression of what's going on
 
-rttnw::rttnw()
+rttnw::rttnw(const render_settings& settings) : core(settings)
 {
     pquit = false;
 
+    output_filename = settings.output;
+    requested_width = settings.image_width;
+    requested_height = settings.image_height;
+
     create_window();
     gl_debug_enable();
     gl_setup();
 
-    while(!pquit && sample_count <= num_samples)
+    cout << "rendering " << core.get_image_width() << "x" << core.get_image_height() << " at " << core.num_samples << " samples, with " << core.get_thread_count() << " worker threads" << endl;
+
+    // tracing runs in the background, this thread just keeps the window up to date
+    core.start();
+
+    while(!pquit && !core.render_finished)
     {
         draw_everything();
     }
@@ -2,14 +2,17 @@
 #define RTTNW
 
 #include "includes.h"
-#include "book_code.h"
+#include "renderer.h"
 
 
+// the interactive front end - a window showing the image as it converges, and
+// some ImGui controls. All the tracing is done by the renderer
+
 class rttnw
 {
 public:
 
-	rttnw();
+	rttnw(const render_settings& settings = render_settings());
 	~rttnw();
 
 private:
@@ -26,14 +29,18 @@ private:
 
 
 
-	const int max_depth = 50;
 	bool send_tex = true;
 
-    color background;
-    float gamma_factor = 0.5f;
+    float gamma_factor = GAMMA_DEFAULT;
+
+	renderer core;
+	std::string output_filename;
+
+	int requested_width;
+	int requested_height;
 
-	hittable_list world;
-	camera cam;
+	unsigned long displayed_generation = 0;
+	float displayed_gamma = -1.0f;
 
 
 
@@ -42,20 +49,6 @@ private:
 	void draw_everything();
 
 
-	void one_thread_sample(int thread_index, int thread_count);
-    color ray_color(const ray& r, const color& background, const hittable& world, int depth);
-
-	std::vector<std::vector<glm::dvec3>> accumulated_samples;
-
-
-
-
-    int num_samples = NUM_SAMPLES_DEFAULT;
-    int sample_count = 0;
-
-    long int total_time = 0;
-
-
 	bool pquit;
 	void quit();
 };
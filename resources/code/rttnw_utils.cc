@@ -36,7 +36,11 @@ void rttnw::create_window()
 	cout << "creating window.....................";
 
 	// window = SDL_CreateWindow( "OpenGL Window", 0, 0, total_screen_width, total_screen_height, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN | SDL_WINDOW_BORDERLESS );
-	window = SDL_CreateWindow( "OpenGL Window", 100, 100, WIDTH, HEIGHT, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN | SDL_WINDOW_RESIZABLE );
+	// window matches the image, scaled down to fit on the screen if need be
+	int image_width = core.get_image_width();
+	int image_height = core.get_image_height();
+	double window_scale = std::min(1.0, std::min(0.9 * total_screen_width / image_width, 0.9 * total_screen_height / image_height));
+	window = SDL_CreateWindow( "OpenGL Window", 100, 100, int(image_width * window_scale), int(image_height * window_scale), SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN | SDL_WINDOW_RESIZABLE );
   	SDL_ShowWindow(window);
 
 	cout << "done." << endl;
@@ -137,106 +141,6 @@ void rttnw::create_window()
 	colors[ImGuiCol_NavWindowingHighlight]  = ImVec4(1.00f, 1.00f, 1.00f, 0.70f);
 	colors[ImGuiCol_NavWindowingDimBg]      = ImVec4(0.80f, 0.80f, 0.80f, 0.20f);
 	colors[ImGuiCol_ModalWindowDimBg]       = ImVec4(0.80f, 0.80f, 0.80f, 0.35f);
-
-
-    accumulated_samples.resize(WIDTH);
-
-    for(auto& x : accumulated_samples)
-    {
-        x.resize(HEIGHT);
-    }
-
-
-	 const auto aspect_ratio = 1.0 / 1.0;
-    const int image_width = 600;
-    // const int image_height = static_cast<int>(image_width / aspect_ratio);
-
-	    point3 lookfrom;
-	    point3 lookat;
-	    vec3 vup(0,1,0);
-	    auto vfov = 40.0;
-	    auto aperture = 0.0;
-	    auto dist_to_focus = 10.0;
-	    background = color(0,0,0);
-
-	    switch (8) {
-	        case 1:
-	            world = random_scene();
-	            lookfrom = point3(13,2,3);
-	            lookat = point3(0,0,0);
-	            vfov = 20.0;
-	            background = color(0.70, 0.80, 1.00);
-	            break;
-
-	        case 2:
-	            world = two_spheres();
-	            lookfrom = point3(13,2,3);
-	            lookat = point3(0,0,0);
-	            vfov = 20.0;
-	            background = color(0.70, 0.80, 1.00);
-	            break;
-
-	        case 3:
-	            world = two_perlin_spheres();
-	            lookfrom = point3(13,2,3);
-	            lookat = point3(0,0,0);
-	            vfov = 20.0;
-	            background = color(0.70, 0.80, 1.00);
-	            break;
-
-	        case 4:
-	            world = earth();
-	            lookfrom = point3(0,0,12);
-	            lookat = point3(0,0,0);
-	            vfov = 20.0;
-	            background = color(0.70, 0.80, 1.00);
-	            break;
-
-	        case 5:
-	            world = simple_light();
-	            lookfrom = point3(26,3,6);
-	            lookat = point3(0,2,0);
-	            vfov = 20.0;
-	            break;
-
-	        default:
-	        case 6:
-	            world = cornell_box();
-	            lookfrom = point3(278, 278, -800);
-	            lookat = point3(278, 278, 0);
-	            vfov = 40.0;
-	            break;
-
-	        case 7:
-	            world = cornell_balls();
-	            lookfrom = point3(278, 278, -800);
-	            lookat = point3(278, 278, 0);
-	            vfov = 40.0;
-	            break;
-
-	        case 8:
-	            world = cornell_smoke();
-	            lookfrom = point3(278, 278, -800);
-	            lookat = point3(278, 278, 0);
-	            vfov = 40.0;
-	            break;
-
-	        case 9:
-	            world = cornell_final();
-	            lookfrom = point3(278, 278, -800);
-	            lookat = point3(278, 278, 0);
-	            vfov = 40.0;
-	            break;
-
-	        case 10:
-	            world = final_scene();
-	            lookfrom = point3(478, 278, -600);
-	            lookat = point3(278, 278, 0);
-	            vfov = 40.0;
-	            break;
-	    }
-
-    cam = camera(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus, 0.0, 1.0);
 }
 
 
@@ -344,107 +248,36 @@ void rttnw::draw_everything()
 
 	// draw the stuff on the GPU
 
-    // start a timer
+    // the tracing happens on the render thread - all this does is pick up the most
+    // recently completed pass, if there's one we haven't shown yet
     auto start = std::chrono::high_resolution_clock::now();
 
-    int num_threads = 16;
-
-    // launch all the threads
-    std::thread t0(&rttnw::one_thread_sample, this, 0, num_threads);
-    std::thread t1(&rttnw::one_thread_sample, this, 1, num_threads);
-    std::thread t2(&rttnw::one_thread_sample, this, 2, num_threads);
-    std::thread t3(&rttnw::one_thread_sample, this, 3, num_threads);
-    std::thread t4(&rttnw::one_thread_sample, this, 4, num_threads);
-    std::thread t5(&rttnw::one_thread_sample, this, 5, num_threads);
-    std::thread t6(&rttnw::one_thread_sample, this, 6, num_threads);
-    std::thread t7(&rttnw::one_thread_sample, this, 7, num_threads);
-    std::thread t8(&rttnw::one_thread_sample, this, 8, num_threads);
-    std::thread t9(&rttnw::one_thread_sample, this, 9, num_threads);
-    std::thread t10(&rttnw::one_thread_sample, this, 10, num_threads);
-    std::thread t11(&rttnw::one_thread_sample, this, 11, num_threads);
-    std::thread t12(&rttnw::one_thread_sample, this, 12, num_threads);
-    std::thread t13(&rttnw::one_thread_sample, this, 13, num_threads);
-    std::thread t14(&rttnw::one_thread_sample, this, 14, num_threads);
-    std::thread t15(&rttnw::one_thread_sample, this, 15, num_threads);
-
-
-    // join all the threads
-    t0.join();
-    t1.join();
-    t2.join();
-    t3.join();
-    t4.join();
-    t5.join();
-    t6.join();
-    t7.join();
-    t8.join();
-    t9.join();
-    t10.join();
-    t11.join();
-    t12.join();
-    t13.join();
-    t14.join();
-    t15.join();
-
-
-    // increment the sample count
-    sample_count++;
-
-    // stop that timer, add its value to the total time
-    auto end = std::chrono::high_resolution_clock::now();
-    int time_in_milliseconds = (int)std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(end - start).count();
-    total_time += time_in_milliseconds;
-
-	cout << "sample took " << time_in_milliseconds << "ms" << endl;
-
-    // start a new timer, to see how long it took to send the data to the GPU
-    start = std::chrono::high_resolution_clock::now();
-
-
     if(send_tex)
     {
         std::vector<unsigned char> tex_data;
-        tex_data.resize(0);
-
-        for(unsigned int y = 0; y < HEIGHT; y++)
-        {	for(unsigned int x = 0; x < WIDTH; x++)
-            {
-				auto r = accumulated_samples[x][y].x/static_cast<double>(sample_count);
-				auto g = accumulated_samples[x][y].y/static_cast<double>(sample_count);
-				auto b = accumulated_samples[x][y].z/static_cast<double>(sample_count);
-
-				// Replace NaN components with zero. See explanation in Ray Tracing: The Rest of Your Life.
-				if (r != r) r = 0.0;
-				if (g != g) g = 0.0;
-				if (b != b) b = 0.0;
-
-				// // gamma-correct for gamma=2.0. (sqrt, aka pow(blah, -2))
-				// r = sqrt(r);
-				// g = sqrt(g);
-				// b = sqrt(b);
-
-				//more flexible gamma correction
-				r = pow(r, gamma_factor);
-				g = pow(g, gamma_factor);
-				b = pow(b, gamma_factor);
-
-                tex_data.push_back(static_cast<int>(256 * clamp(r, 0.0, 0.999)));
-                tex_data.push_back(static_cast<int>(256 * clamp(g, 0.0, 0.999)));
-                tex_data.push_back(static_cast<int>(256 * clamp(b, 0.0, 0.999)));
-                tex_data.push_back(static_cast<unsigned char>(255));
-            }
+        int tex_width = 0, tex_height = 0;
+
+        // gamma changes need the image re-averaged, even without a new pass
+        if(gamma_factor != displayed_gamma)
+        {
+            displayed_gamma = gamma_factor;
+            displayed_generation = 0;
         }
 
-        // buffer the averaged data to the GPU
-        glBindTexture(GL_TEXTURE_2D, display_texture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, WIDTH, HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, &tex_data[0]);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        bool have_new_data = core.snapshot(tex_data, tex_width, tex_height, gamma_factor, displayed_generation);
+
+        if(have_new_data)
+        {
+            // buffer the averaged data to the GPU
+            glBindTexture(GL_TEXTURE_2D, display_texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex_width, tex_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &tex_data[0]);
+            glGenerateMipmap(GL_TEXTURE_2D);
+        }
     }
 
     // stop the timer
-    end = std::chrono::high_resolution_clock::now();
+    auto end = std::chrono::high_resolution_clock::now();
     int time_buffering = (int)std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(end - start).count();
-    total_time += time_buffering;
 
     // texture display
     glUseProgram(display_shader);
@@ -465,26 +298,37 @@ void rttnw::draw_everything()
 
 	// do my own window
 	ImGui::SetNextWindowPos(ImVec2(10,10));
-	ImGui::SetNextWindowSize(ImVec2(300, 250));
+	ImGui::SetNextWindowSize(ImVec2(300, 330));
 	ImGui::Begin("Controls", NULL, 0);
 
     //do the other widgets
     ImGui::Text("How many samples do you want?");
 
-    ImGui::InputInt(" ", &num_samples);
+    int requested_samples = core.num_samples;
+    if(ImGui::InputInt(" ", &requested_samples))
+        core.num_samples = requested_samples;
     ImGui::SameLine(); HelpMarker("You can apply arithmetic operators +,*,/ on numerical values.\n  e.g. [ 100 ], input \'*2\', result becomes [ 200 ]\nUse +- to subtract.\n");
-    ImGui::Text("%i samples have been completed", sample_count);
+    ImGui::Text("%i samples have been completed", core.sample_count.load());
+    ImGui::Text("%i tiles are still sampling", core.tiles_sampling.load());
 	ImGui::Text(" ");
 
 	ImGui::SliderFloat(" Gamma ", &gamma_factor, 0.0f, 2.0f, "%.3f");
 
+    ImGui::Text(" ");
+    ImGui::Text("Image size (restarts the render)");
+    ImGui::InputInt("width", &requested_width);
+    ImGui::InputInt("height", &requested_height);
+    if(ImGui::Button("Apply") && requested_width > 1 && requested_height > 1)
+        core.resize(requested_width, requested_height);
+    ImGui::SameLine(); ImGui::Text("currently %ix%i", core.get_image_width(), core.get_image_height());
+
     ImGui::Text(" ");
     ImGui::Checkbox("Send to GPU each sample: ", &send_tex);
 
     ImGui::Text(" ");
-    ImGui::Text("Previous sample took:        %*i ms", 9, time_in_milliseconds);
+    ImGui::Text("Previous sample took:        %*i ms", 9, core.last_sample_time.load());
     ImGui::Text("Averaging/GPU buffering took:%*i ms", 9, time_buffering);
-    ImGui::Text("Total elapsed:              %*li ms", 10, total_time);
+    ImGui::Text("Total elapsed:              %*li ms", 10, core.total_time.load());
 
 
 
@@ -518,61 +362,12 @@ void rttnw::draw_everything()
 }
 
 
-color rttnw::ray_color(const ray& r, const color& background, const hittable& world, int depth) {
-    hit_record rec;
-
-    // If we've exceeded the ray bounce limit, no more light is gathered.
-    if (depth <= 0)
-        return color(0,0,0);
-
-    // If the ray hits nothing, return the background color.
-    if (!world.hit(r, 0.001, infinity, rec))
-        return background;
-
-    ray scattered;
-    color attenuation;
-    color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
-
-    if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-        return emitted;
-
-    return emitted + attenuation * ray_color(scattered, background, world, depth-1);
-}
-
-void rttnw::one_thread_sample(int thread_index, int thread_count)
-{
-    long unsigned int seed = std::chrono::system_clock::now().time_since_epoch().count();
-
-    std::default_random_engine engine{seed};
-    std::uniform_real_distribution<double> distribution{0, 1};
-
-    // do a sample for all the pixels - this takes time
-    for(auto & x : accumulated_samples)
-    {
-        for(auto & y : x)
-        {
-            int x_coord = &x - &accumulated_samples[0];
-            int y_coord = &y - &x[0];
-
-            if(x_coord % thread_count == thread_index)
-            {
-                double x_fl = (static_cast<double>(x_coord) + distribution(engine))/(static_cast<double>(WIDTH-1));
-                double y_fl = (static_cast<double>(y_coord) + distribution(engine))/(static_cast<double>(HEIGHT-1));
-
-                ray r = cam.get_ray(x_fl, y_fl);
-
-                // figure out the color, put it in 'sample'
-                color sample = ray_color(r, background, world, max_depth);
-
-                // push it onto the vector of samples for this pixel
-                y += glm::dvec3(sample.x(), sample.y(), sample.z());
-            }
-        }
-    }
-}
-
 void rttnw::quit()
 {
+  // stop the render thread at the end of its current pass
+  pquit = true;
+  core.stop();
+
   //shutdown everything
   ImGui_ImplOpenGL3_Shutdown();
   ImGui_ImplSDL2_Shutdown();
@@ -584,59 +379,10 @@ void rttnw::quit()
   SDL_Quit();
 
   //average the samples and create your output using LodePNG
-    std::vector<unsigned char> tex_data;
-    tex_data.resize(0);             //zero it out
-
-
-
-
-    // iterate through the samples per pixel and compute the average color
-    for(int y = HEIGHT-1; y >= 0; y--)         // iterating through y
-    {   for(int x = 0; x < WIDTH; x++)         // iterating through x
-        {
-			auto r = accumulated_samples[x][y].x/static_cast<double>(sample_count);
-			auto g = accumulated_samples[x][y].y/static_cast<double>(sample_count);
-			auto b = accumulated_samples[x][y].z/static_cast<double>(sample_count);
-
-			// Replace NaN components with zero. See explanation in Ray Tracing: The Rest of Your Life.
-			if (r != r) r = 0.0;
-			if (g != g) g = 0.0;
-			if (b != b) b = 0.0;
-
-			// // gamma-correct for gamma=2.0. (sqrt)
-			// r = sqrt(r);
-			// g = sqrt(g);
-			// b = sqrt(b);
-
-			//more flexible gamma correction
-			r = pow(r, gamma_factor);
-			g = pow(g, gamma_factor);
-			b = pow(b, gamma_factor);
-
-			tex_data.push_back(static_cast<int>(256 * clamp(r, 0.0, 0.999)));
-			tex_data.push_back(static_cast<int>(256 * clamp(g, 0.0, 0.999)));
-			tex_data.push_back(static_cast<int>(256 * clamp(b, 0.0, 0.999)));
-			tex_data.push_back(static_cast<unsigned char>(255));
-        }
-    }
-
-
-    unsigned width, height;
-
-    width = WIDTH;
-    height = HEIGHT;
-
-    /* tex_data.resize(4*WIDTH*HEIGHT); */
-    std::string filename = std::string("save.png");
-
-    unsigned error = lodepng::encode(filename.c_str(), tex_data, width, height);
-
-    if(error) std::cout << "decode error during save(\" "+ filename +" \") " << error << ": " << lodepng_error_text(error) << std::endl;
-
-
-
+  core.save_png(output_filename, gamma_factor);
+  core.get_path_stats().print(cout);
 
-    cout << "goodbye." << endl;
+  cout << "goodbye." << endl;
 }
 
 #endif
@@ -0,0 +1,181 @@
+#ifndef THREAD_POOL
+#define THREAD_POOL
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <algorithm>
+
+// long-lived set of worker threads - created once, then handed a job for each
+// sample pass instead of spawning and joining a fresh batch of std::threads.
+// Also takes one-off tasks (fork/join style, e.g. building BVH subtrees), which
+// can be nested - a thread waiting on a task_group runs queued tasks itself
+// rather than blocking, so a task can submit more tasks and wait on them
+
+// counts the outstanding tasks submitted against it
+struct task_group
+{
+    int pending = 0;
+};
+
+class thread_pool
+{
+public:
+
+    // zero (or less) means use however many cores the machine reports
+    explicit thread_pool(int num_threads = 0)
+    {
+        if(num_threads <= 0)
+            num_threads = static_cast<int>(std::thread::hardware_concurrency());
+        if(num_threads <= 0)    // hardware_concurrency() is allowed to return 0
+            num_threads = 1;
+
+        for(int i = 0; i < num_threads; i++)
+            workers.emplace_back(&thread_pool::worker_loop, this, i);
+    }
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stopping = true;
+        }
+        wake.notify_all();
+
+        for(auto& w : workers)
+            w.join();
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    int size() const { return static_cast<int>(workers.size()); }
+
+    // calls job(worker_index) once on every worker, returns when all of them have finished
+    void run(const std::function<void(int)>& job)
+    {
+        std::unique_lock<std::mutex> lock(m);
+        current_job = &job;
+        running = size();
+        generation++;
+        wake.notify_all();
+
+        done.wait(lock, [this]{ return running == 0; });
+        current_job = nullptr;
+    }
+
+    // queue a task - the group has to stay alive until wait() on it returns
+    void submit(task_group& group, std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            group.pending++;
+            tasks.push_back(queued_task{&group, std::move(task)});
+        }
+        wake.notify_one();
+        task_finished.notify_all();     // threads inside wait() can pick it up too
+    }
+
+    // returns when every task submitted to the group has finished, running
+    // queued tasks (from any group) on the calling thread in the meantime
+    void wait(task_group& group)
+    {
+        std::unique_lock<std::mutex> lock(m);
+        while(group.pending > 0)
+        {
+            if(!tasks.empty())
+            {
+                run_one_task(lock);
+                continue;
+            }
+
+            task_finished.wait(lock, [&]{ return group.pending == 0 || !tasks.empty(); });
+        }
+    }
+
+    // splits [0, count) into a few chunks per worker and runs body(begin, end) on each as
+    // tasks, returning when they've all finished
+    void parallel_for(size_t count, const std::function<void(size_t, size_t)>& body)
+    {
+        task_group group;
+        size_t chunks = std::min(count, static_cast<size_t>(size()) * 4);
+        for(size_t c = 0; c < chunks; c++)
+            submit(group, [&body, c, chunks, count]{ body(count * c / chunks, count * (c + 1) / chunks); });
+        wait(group);
+    }
+
+private:
+
+    struct queued_task
+    {
+        task_group* group;
+        std::function<void()> work;
+    };
+
+    // pops a task and runs it with the lock released - lock is held again on return
+    void run_one_task(std::unique_lock<std::mutex>& lock)
+    {
+        queued_task task = std::move(tasks.front());
+        tasks.pop_front();
+
+        lock.unlock();
+        task.work();
+        lock.lock();
+
+        task.group->pending--;
+        task_finished.notify_all();
+    }
+
+    void worker_loop(int index)
+    {
+        unsigned long seen_generation = 0;
+
+        while(true)
+        {
+            const std::function<void(int)>* job;
+            {
+                std::unique_lock<std::mutex> lock(m);
+                wake.wait(lock, [&]{ return stopping || generation != seen_generation || !tasks.empty(); });
+
+                if(stopping)
+                    return;
+
+                if(generation == seen_generation)
+                {
+                    run_one_task(lock);
+                    continue;
+                }
+
+                seen_generation = generation;
+                job = current_job;
+            }
+
+            (*job)(index);
+
+            {
+                std::lock_guard<std::mutex> lock(m);
+                running--;
+            }
+            done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> workers;
+
+    std::mutex m;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::condition_variable task_finished;
+
+    std::deque<queued_task> tasks;
+
+    const std::function<void(int)>* current_job = nullptr;
+    unsigned long generation = 0;
+    int running = 0;
+    bool stopping = false;
+};
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef TILE_SCHEDULER
+#define TILE_SCHEDULER
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <algorithm>
+
+// rectangular block of pixels, [x0,x1) by [y0,y1)
+struct tile
+{
+    int x0, y0;
+    int x1, y1;
+};
+
+// hands out tiles for a sample pass - each worker starts out with a contiguous
+// run of tiles in its own deque, works through it front to back, and once it
+// is empty steals from the back of the other workers' deques, so the expensive
+// parts of the image get spread across whoever is free
+
+class tile_scheduler
+{
+public:
+
+    // the whole image, cut into tiles
+    static std::vector<tile> make_tiles(int width, int height, int tile_size)
+    {
+        std::vector<tile> tiles;
+        for(int y = 0; y < height; y += tile_size)
+            for(int x = 0; x < width; x += tile_size)
+                tiles.push_back(tile{x, y, std::min(x + tile_size, width), std::min(y + tile_size, height)});
+        return tiles;
+    }
+
+    void reset(int width, int height, int tile_size, int worker_count)
+    {
+        reset(make_tiles(width, height, tile_size), worker_count);
+    }
+
+    // a pass over just these tiles - e.g. the ones adaptive sampling hasn't finished with
+    void reset(const std::vector<tile>& tiles, int worker_count)
+    {
+        if((int)queues.size() != worker_count)
+        {
+            queues.clear();
+            for(int i = 0; i < worker_count; i++)
+                queues.push_back(std::make_unique<tile_queue>());
+        }
+
+        // deal out contiguous runs so neighbouring tiles tend to stay on one core
+        size_t num_tiles = tiles.size();
+        for(int i = 0; i < worker_count; i++)
+        {
+            std::lock_guard<std::mutex> lock(queues[i]->m);
+            queues[i]->tiles.assign(tiles.begin() + (num_tiles * i) / worker_count,
+                                    tiles.begin() + (num_tiles * (i+1)) / worker_count);
+        }
+    }
+
+    // false once there is no work left anywhere
+    bool next(int worker_index, tile& t)
+    {
+        {   // own queue first, from the front
+            tile_queue& own = *queues[worker_index];
+            std::lock_guard<std::mutex> lock(own.m);
+            if(!own.tiles.empty())
+            {
+                t = own.tiles.front();
+                own.tiles.pop_front();
+                return true;
+            }
+        }
+
+        // then go around the other workers, taking from the back
+        int worker_count = static_cast<int>(queues.size());
+        for(int offset = 1; offset < worker_count; offset++)
+        {
+            tile_queue& victim = *queues[(worker_index + offset) % worker_count];
+            std::lock_guard<std::mutex> lock(victim.m);
+            if(!victim.tiles.empty())
+            {
+                t = victim.tiles.back();
+                victim.tiles.pop_back();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+private:
+
+    struct tile_queue
+    {
+        std::mutex m;
+        std::deque<tile> tiles;
+    };
+
+    // unique_ptr because std::mutex can't be moved around inside the vector
+    std::vector<std::unique_ptr<tile_queue>> queues;
+};
+
+#endif